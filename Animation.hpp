@@ -0,0 +1,410 @@
+#pragma once
+
+#include "Crc32.hpp"
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Animation image kept in flash and played by the FlashAnimation scene.
+//
+// Little-endian layout:
+//
+//   0    magic        "ANIM"
+//   4    version      AnimationFormat::Version (u16)
+//   6    fps          frames per second (u16)
+//   8    ledCount     LEDs per frame (u32)
+//   12   frameCount   (u32)
+//   16   frame table  frameCount u32 offsets from the start of the image, the
+//                     top bit set for keyframes
+//   ...  frames
+//
+// A frame is a list of ops covering the LEDs in order, each an op byte and
+// (except End) a u16 LED count:
+//
+//   Skip n          the next n LEDs keep the last frame's colors
+//   Run n r g b     the next n LEDs are one color
+//   Raw n rgb...    the next n LEDs, a triplet each
+//   End             the rest keep the last frame's colors
+//
+// Keyframes have no Skip and cover every LED, so playback can start at any of
+// them; the first frame is always one. Other frames are deltas from the one
+// before. Everything is read a byte at a time, so the image needs no alignment
+// and frames decode straight from flash.
+namespace AnimationFormat
+{
+  constexpr uint32_t Magic = 0x4D494E41;  // "ANIM"
+  constexpr uint16_t Version = 1;
+  constexpr uint32_t HeaderSize = 16;
+  constexpr uint32_t KeyframeBit = 0x80000000;
+  constexpr uint32_t MaxOpLeds = 0xFFFF;
+
+  constexpr uint8_t End = 0;
+  constexpr uint8_t Skip = 1;
+  constexpr uint8_t Run = 2;
+  constexpr uint8_t Raw = 3;
+
+  inline uint32_t read16(const uint8_t* p)
+  {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+  }
+
+  inline uint32_t read32(const uint8_t* p)
+  {
+    return read16(p) | (read16(p + 2) << 16);
+  }
+}
+
+// Read-only view of an image. Nothing is copied; a frame is decoded op by op
+// from wherever the image is mapped.
+class AnimationImage
+{
+public:
+  AnimationImage() = default;
+
+  // size is the most the image can span, e.g. the flash region it's in.
+  // Anything that doesn't parse leaves the view invalid.
+  AnimationImage(const uint8_t* data, uint32_t size)
+  {
+    using namespace AnimationFormat;
+    if (!data || size < HeaderSize || read32(data) != Magic || read16(data + 4) != Version)
+    {
+      return;
+    }
+    uint32_t fps = read16(data + 6);
+    uint32_t leds = read32(data + 8);
+    uint32_t frames = read32(data + 12);
+    if (fps == 0 || leds == 0 || frames == 0 || frames > (size - HeaderSize) / 4)
+    {
+      return;
+    }
+    data_ = data;
+    size_ = size;
+    fps_ = fps;
+    leds_ = leds;
+    frames_ = frames;
+  }
+
+  bool valid() const { return data_ != nullptr; }
+  uint32_t fps() const { return fps_; }
+  uint32_t leds() const { return leds_; }
+  uint32_t frames() const { return frames_; }
+
+  bool keyframe(uint32_t frame) const
+  {
+    return (entry(frame) & AnimationFormat::KeyframeBit) != 0;
+  }
+
+  // The latest keyframe at or before frame
+  uint32_t keyframeBefore(uint32_t frame) const
+  {
+    while (frame > 0 && !keyframe(frame)) --frame;
+    return frame;
+  }
+
+  // Apply a frame to out, which holds the frame before it (or anything, for a
+  // keyframe). LEDs past size are skipped, and out's LEDs past the image's
+  // are left alone. Returns false if the frame is malformed, in which case
+  // out may be partly written.
+  bool decode(uint32_t frame, RGBColor* out, uint32_t size) const
+  {
+    using namespace AnimationFormat;
+    uint32_t offset = entry(frame) & ~KeyframeBit;
+    if (offset >= size_)
+    {
+      return false;
+    }
+    const uint8_t* p = data_ + offset;
+    const uint8_t* end = data_ + size_;
+    uint32_t led = 0;
+    while (p < end)
+    {
+      uint8_t op = *p++;
+      if (op == End)
+      {
+        return true;
+      }
+      if (end - p < 2)
+      {
+        return false;
+      }
+      uint32_t count = read16(p);
+      p += 2;
+      if (count > leds_ - led)
+      {
+        return false;
+      }
+      uint32_t shown = led < size ? std::min(count, size - led) : 0;
+      if (op == Run)
+      {
+        if (end - p < 3) return false;
+        std::fill(out + led, out + led + shown, RGBColor{p[0], p[1], p[2]});
+        p += 3;
+      }
+      else if (op == Raw)
+      {
+        if ((uint32_t)(end - p) < count * 3) return false;
+        RGBColor* o = out + led;
+        const uint8_t* q = p;
+        for (uint32_t i = 0; i < shown; ++i, q += 3)
+        {
+          o[i] = RGBColor{q[0], q[1], q[2]};
+        }
+        p += count * 3;
+      }
+      else if (op != Skip)
+      {
+        return false;
+      }
+      led += count;
+    }
+    return false;
+  }
+
+private:
+  uint32_t entry(uint32_t frame) const
+  {
+    return AnimationFormat::read32(data_ + AnimationFormat::HeaderSize + frame * 4);
+  }
+
+  const uint8_t* data_ = nullptr;
+  uint32_t size_ = 0;
+  uint32_t fps_ = 0;
+  uint32_t leds_ = 0;
+  uint32_t frames_ = 0;
+};
+
+// Builds an image from whole frames. Used by the host-side encoder tool and
+// the decoder benchmark.
+class AnimationEncoder
+{
+public:
+  // A keyframe goes in every keyframeInterval frames (0 for only the first),
+  // which bounds how far playback has to decode to catch up after a seek
+  AnimationEncoder(uint32_t leds, uint16_t fps, uint32_t keyframeInterval) :
+    leds_(leds), fps_(fps), keyframeInterval_(keyframeInterval), previous_(leds)
+  {
+  }
+
+  // frame must have leds() LEDs
+  void addFrame(const LEDBuffer& frame)
+  {
+    uint32_t index = (uint32_t)offsets_.size();
+    bool key = index == 0 || (keyframeInterval_ > 0 && index % keyframeInterval_ == 0);
+    offsets_.push_back((uint32_t)data_.size() | (key ? AnimationFormat::KeyframeBit : 0));
+    encodeFrame(frame, key);
+    std::copy(frame.begin(), frame.begin() + leds_, previous_.begin());
+  }
+
+  uint32_t leds() const { return leds_; }
+  uint32_t frames() const { return (uint32_t)offsets_.size(); }
+
+  // The finished image
+  std::vector<uint8_t> image() const
+  {
+    using namespace AnimationFormat;
+    std::vector<uint8_t> out;
+    uint32_t tableEnd = HeaderSize + (uint32_t)offsets_.size() * 4;
+    put32(out, Magic);
+    put16(out, Version);
+    put16(out, fps_);
+    put32(out, leds_);
+    put32(out, (uint32_t)offsets_.size());
+    for (uint32_t entry : offsets_)
+    {
+      put32(out, entry + tableEnd);
+    }
+    out.insert(out.end(), data_.begin(), data_.end());
+    return out;
+  }
+
+private:
+  static bool same(const RGBColor& a, const RGBColor& b)
+  {
+    return a.R == b.R && a.G == b.G && a.B == b.B;
+  }
+
+  static void put16(std::vector<uint8_t>& out, uint32_t v)
+  {
+    out.push_back((uint8_t)v);
+    out.push_back((uint8_t)(v >> 8));
+  }
+
+  static void put32(std::vector<uint8_t>& out, uint32_t v)
+  {
+    put16(out, v);
+    put16(out, v >> 16);
+  }
+
+  void op(uint8_t code, uint32_t count)
+  {
+    data_.push_back(code);
+    put16(data_, count);
+  }
+
+  // Three of a color are worth a Run (6 bytes against 9 raw), two unchanged
+  // LEDs a Skip (3 bytes, and the Raw op it splits costs 3 more)
+  bool runAt(const LEDBuffer& frame, uint32_t i) const
+  {
+    return i + 2 < leds_ && same(frame[i], frame[i + 1]) && same(frame[i], frame[i + 2]);
+  }
+
+  bool skipAt(const LEDBuffer& frame, uint32_t i, bool key) const
+  {
+    return !key && i + 1 < leds_ && same(frame[i], previous_[i]) && same(frame[i + 1], previous_[i + 1]);
+  }
+
+  void encodeFrame(const LEDBuffer& frame, bool key)
+  {
+    using namespace AnimationFormat;
+    uint32_t i = 0;
+    while (i < leds_)
+    {
+      uint32_t n = 0;
+      if (!key && same(frame[i], previous_[i]))
+      {
+        while (i + n < leds_ && n < MaxOpLeds && same(frame[i + n], previous_[i + n])) ++n;
+        if (i + n == leds_) break;  // End covers the rest
+        op(Skip, n);
+      }
+      else if (runAt(frame, i))
+      {
+        while (i + n < leds_ && n < MaxOpLeds && same(frame[i + n], frame[i])) ++n;
+        op(Run, n);
+        data_.push_back(frame[i].R);
+        data_.push_back(frame[i].G);
+        data_.push_back(frame[i].B);
+      }
+      else
+      {
+        n = 1;
+        while (i + n < leds_ && n < MaxOpLeds && !runAt(frame, i + n) && !skipAt(frame, i + n, key)) ++n;
+        op(Raw, n);
+        for (uint32_t j = i; j < i + n; ++j)
+        {
+          data_.push_back(frame[j].R);
+          data_.push_back(frame[j].G);
+          data_.push_back(frame[j].B);
+        }
+      }
+      i += n;
+    }
+    data_.push_back(End);
+  }
+
+  uint32_t leds_;
+  uint16_t fps_;
+  uint32_t keyframeInterval_;
+  LEDBuffer previous_;
+  std::vector<uint32_t> offsets_;
+  std::vector<uint8_t> data_;
+};
+
+// Writes an uploaded image into a flash region as it arrives, a page at a
+// time, erasing each sector just before its first page.
+//
+// The first page, which holds the header, is kept in RAM and only written
+// once the whole image is in and its CRC checks out. Until then the header
+// sector reads as erased, so a failed or interrupted upload leaves no image
+// rather than a broken one.
+//
+// Flash is the same backend FlashJournal uses.
+template <typename Flash>
+class AnimationWriter
+{
+public:
+  AnimationWriter(Flash& flash) : flash_(flash) {}
+
+  // Start an upload of size bytes. The old image is gone from here on.
+  bool begin(uint32_t size)
+  {
+    active_ = false;
+    if (size < AnimationFormat::HeaderSize || size > flash_.size())
+    {
+      return false;
+    }
+    if (!flash_.erase(0))
+    {
+      return false;
+    }
+    size_ = size;
+    received_ = 0;
+    pageLen_ = 0;
+    active_ = true;
+    return true;
+  }
+
+  // The next bytes of the image. Returns false if the upload has failed.
+  bool write(const uint8_t* data, size_t len)
+  {
+    if (!active_ || len > size_ - received_)
+    {
+      active_ = false;
+      return false;
+    }
+    while (len > 0)
+    {
+      size_t n = std::min(len, (size_t)(Flash::PageSize - pageLen_));
+      std::memcpy(page_ + pageLen_, data, n);
+      pageLen_ += (uint32_t)n;
+      received_ += (uint32_t)n;
+      data += n;
+      len -= n;
+      if (pageLen_ == Flash::PageSize && !flushPage())
+      {
+        active_ = false;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Finish the upload. crc is the CRC-32 of the whole image. Returns true if
+  // the image is now in flash.
+  bool end(uint32_t crc)
+  {
+    if (!active_ || received_ != size_ || (pageLen_ > 0 && !flushPage()))
+    {
+      active_ = false;
+      return false;
+    }
+    active_ = false;
+    uint32_t firstLen = std::min(size_, (uint32_t)Flash::PageSize);
+    uint32_t check = crc32(0, first_, firstLen);
+    check = crc32(check, flash_.read(firstLen), size_ - firstLen);
+    return check == crc && flash_.program(0, first_);
+  }
+
+  bool active() const { return active_; }
+  uint32_t received() const { return received_; }
+
+private:
+  bool flushPage()
+  {
+    std::fill(page_ + pageLen_, page_ + Flash::PageSize, 0xFF);
+    uint32_t offset = (received_ - 1) / Flash::PageSize * Flash::PageSize;
+    pageLen_ = 0;
+    if (offset == 0)
+    {
+      std::memcpy(first_, page_, Flash::PageSize);
+      return true;
+    }
+    if (offset % Flash::SectorSize == 0 && !flash_.erase(offset))
+    {
+      return false;
+    }
+    return flash_.program(offset, page_);
+  }
+
+  Flash& flash_;
+  uint8_t page_[Flash::PageSize];
+  uint8_t first_[Flash::PageSize];
+  uint32_t pageLen_ = 0;
+  uint32_t size_ = 0;
+  uint32_t received_ = 0;
+  bool active_ = false;
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+// What the audio scenes draw from: the analysis of the latest block
+struct AudioFeatures
+{
+  static constexpr int Bands = 8;
+
+  // Each band's level against its recent peak, 0 to 1, bass first
+  float bands[Bands] = {};
+  // All bands together, against their recent peak, 0 to 1
+  float level = 0.0f;
+  // 1 on the block a beat was detected, falling back to 0 over BeatDecay
+  float beat = 0.0f;
+  // Beats since the analyzer was reset; scenes watch it to step on each beat
+  uint32_t beats = 0;
+};
+
+// In-place radix-2 FFT on Q15 complex values.
+//
+// Every stage halves its outputs, so as long as no input's magnitude is over
+// 32767 nothing overflows and the result is the transform divided by Size.
+// Integer multiplies and shifts only, which the M0+ does in a cycle each; the
+// twiddles are a Q15 cosine table built once.
+template <int Log2Size>
+class FixedFft
+{
+public:
+  static constexpr int Size = 1 << Log2Size;
+  static constexpr double TwoPi = 6.283185307179586;
+
+  FixedFft()
+  {
+    for (int k = 0; k < Size; ++k)
+    {
+      cos_[k] = (int16_t)std::lround(std::cos(TwoPi * k / Size) * 32767.0);
+    }
+  }
+
+  void transform(int16_t* re, int16_t* im) const
+  {
+    // Bit-reversed order, so the butterflies can work in place
+    for (int i = 1, j = 0; i < Size; ++i)
+    {
+      int bit = Size >> 1;
+      for (; j & bit; bit >>= 1)
+      {
+        j ^= bit;
+      }
+      j ^= bit;
+      if (i < j)
+      {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+    }
+
+    for (int half = 1, step = Size / 2; half < Size; half <<= 1, step >>= 1)
+    {
+      for (int k = 0; k < half; ++k)
+      {
+        // e^(-2 pi i k / (2 half)), with sin read a quarter turn along
+        int32_t wr = cos_[k * step];
+        int32_t wi = -cos_[(k * step + Size * 3 / 4) % Size];
+        for (int a = k; a < Size; a += half * 2)
+        {
+          int b = a + half;
+          int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+          int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+          re[b] = (int16_t)((re[a] - tr) >> 1);
+          im[b] = (int16_t)((im[a] - ti) >> 1);
+          re[a] = (int16_t)((re[a] + tr) >> 1);
+          im[a] = (int16_t)((im[a] + ti) >> 1);
+        }
+      }
+    }
+  }
+
+private:
+  int16_t cos_[Size];
+};
+
+// Band energies and beats from blocks of audio.
+//
+// Each block has its DC removed and is scaled up so its loudest sample uses
+// the full 16 bits (the scale is divided back out of the energies), which
+// keeps quiet input from drowning in the FFT's rounding. It then gets a Hann
+// window and a fixed-point FFT, and the power in each bin is summed into
+// AudioFeatures::Bands bands spaced evenly in octaves from the first bin up.
+//
+// Levels are reported against a peak that follows each band up at once and
+// lets go over PeakDecay seconds, so the output spans 0 to 1 whatever the
+// input gain and however little energy music has in the treble.
+//
+// Beats come from the spectral flux in the bass bands, the rise in each bin's
+// power from one block to the next, over the last two blocks: a beat is when
+// that jumps to BeatRise times what it was a block ago and BeatThreshold
+// times its average over the last second, at most once per MinBeatGap. It
+// also has to be NoiseRise times the flux that broadband noise as loud as the
+// treble would cause, so noise and hiss on their own never make beats.
+//
+// Only the per-band numbers (a few dozen per block) are floats.
+class AudioAnalyzer
+{
+public:
+  // What the firmware samples at (AudioInput); 16 ms blocks
+  static constexpr uint32_t DeviceSampleRate = 16000;
+  static constexpr int Log2BlockSize = 8;
+  static constexpr int BlockSize = 1 << Log2BlockSize;
+  static constexpr int Bands = AudioFeatures::Bands;
+  // Bands summed for beat detection
+  static constexpr int BassBands = 3;
+
+  static constexpr float PeakDecay = 4.0f;
+  static constexpr float BandFloor = 0.01f;
+  static constexpr float AverageTime = 1.0f;
+  static constexpr float BeatThreshold = 2.0f;
+  static constexpr float BeatRise = 2.0f;
+  // Times the noise-only rise a beat has to clear
+  static constexpr float NoiseRise = 6.0f;
+  static constexpr float MinBeatGap = 0.25f;
+  static constexpr float BeatDecay = 0.2f;
+  // Band power below this (full scale is about 2^26) counts as silence
+  static constexpr float NoiseFloor = 16.0f;
+
+  AudioAnalyzer(float sampleRate) : sampleRate_(sampleRate)
+  {
+    for (int i = 0; i < BlockSize; ++i)
+    {
+      window_[i] = (int16_t)std::lround((0.5 - 0.5 * std::cos(FixedFft<Log2BlockSize>::TwoPi * i / BlockSize)) * 32767.0);
+    }
+    // Octave-spaced edges from bin 1 to Nyquist, each band at least a bin
+    const float bins = BlockSize / 2;
+    edges_[0] = 1;
+    for (int b = 1; b <= Bands; ++b)
+    {
+      int edge = (int)std::lround(std::pow(bins, (float)b / Bands));
+      edges_[b] = (uint16_t)std::min(std::max(edge, edges_[b - 1] + 1), BlockSize / 2);
+    }
+    float blockSeconds = BlockSize / sampleRate;
+    peakFall_ = std::exp(-blockSeconds / PeakDecay);
+    averageRise_ = 1.0f - std::exp(-blockSeconds / AverageTime);
+    beatFall_ = std::exp(-blockSeconds / BeatDecay);
+    minBeatBlocks_ = (uint32_t)(MinBeatGap / blockSeconds);
+    reset();
+  }
+
+  // Forget everything heard so far
+  void reset()
+  {
+    features_ = AudioFeatures();
+    std::fill(energies_, energies_ + Bands, 0.0f);
+    std::fill(peaks_, peaks_ + Bands, NoiseFloor);
+    levelPeak_ = NoiseFloor;
+    std::fill(lastBins_, lastBins_ + BlockSize / 2, 0.0f);
+    lastFlux_ = 0.0f;
+    onsetAverage_ = 0.0f;
+    lastOnset_ = 0.0f;
+    blocks_ = 0;
+    lastBeatBlock_ = 0;
+  }
+
+  // Analyze BlockSize samples
+  void process(const int16_t* samples)
+  {
+    // DC and the loudest excursion from it
+    int32_t sum = 0;
+    for (int i = 0; i < BlockSize; ++i)
+    {
+      sum += samples[i];
+    }
+    int32_t dc = sum / BlockSize;
+    int32_t peak = 0;
+    for (int i = 0; i < BlockSize; ++i)
+    {
+      peak = std::max(peak, std::abs(samples[i] - dc));
+    }
+    int shift = 0;
+    while (peak > 0 && (peak << (shift + 1)) <= 32767)
+    {
+      ++shift;
+    }
+
+    for (int i = 0; i < BlockSize; ++i)
+    {
+      int32_t s = std::max(-32767, std::min(32767, (samples[i] - dc) * (1 << shift)));
+      re_[i] = (int16_t)((s * window_[i]) >> 15);
+      im_[i] = 0;
+    }
+    fft_.transform(re_, im_);
+
+    float total = 0.0f;
+    float unscale = 1.0f / (float)(1u << (2 * shift));
+    for (int b = 0; b < Bands; ++b)
+    {
+      uint64_t power = 0;
+      for (int k = edges_[b]; k < edges_[b + 1]; ++k)
+      {
+        power += (uint32_t)(re_[k] * re_[k]) + (uint32_t)(im_[k] * im_[k]);
+      }
+      energies_[b] = (float)power * unscale;
+      total += energies_[b];
+    }
+
+    // Levels against a decaying peak, as amplitudes. A band never counts
+    // its peak as less than BandFloor of the loudest band's, or a band with
+    // only a little steady noise in it would read full.
+    float loudest = 0.0f;
+    for (int b = 0; b < Bands; ++b)
+    {
+      peaks_[b] = std::max({energies_[b], peaks_[b] * peakFall_, NoiseFloor});
+      loudest = std::max(loudest, peaks_[b]);
+    }
+    for (int b = 0; b < Bands; ++b)
+    {
+      features_.bands[b] = std::sqrt(energies_[b] / std::max(peaks_[b], loudest * BandFloor));
+    }
+    levelPeak_ = std::max({total, levelPeak_ * peakFall_, NoiseFloor * Bands});
+    features_.level = std::sqrt(total / levelPeak_);
+
+    // Spectral flux in the bass: how much each bass bin's power rose since
+    // the block before, over the last two blocks (a kick lasts longer than
+    // that). A steady bass line adds nothing; only new energy does.
+    const int bassEnd = edges_[BassBands];
+    float bass = 0.0f;
+    float flux = 0.0f;
+    for (int k = edges_[0]; k < bassEnd; ++k)
+    {
+      float power = (float)((uint32_t)(re_[k] * re_[k]) + (uint32_t)(im_[k] * im_[k])) * unscale;
+      flux += std::max(0.0f, power - lastBins_[k]);
+      lastBins_[k] = power;
+      bass += power;
+    }
+    float onset = flux + lastFlux_;
+    lastFlux_ = flux;
+
+    // The rise broadband noise as loud as the treble would give the bass
+    // bins, so a fluctuation in noise or hiss never counts as a beat
+    float bassBins = (float)(bassEnd - edges_[0]);
+    float noiseRise = (total - bass) / (float)(edges_[Bands] - bassEnd) * bassBins * NoiseRise;
+
+    features_.beat *= beatFall_;
+    ++blocks_;
+    if (onset > onsetAverage_ * BeatThreshold && onset > lastOnset_ * BeatRise && onset > noiseRise &&
+        bass > NoiseFloor * BassBands && blocks_ - lastBeatBlock_ >= minBeatBlocks_)
+    {
+      features_.beat = 1.0f;
+      ++features_.beats;
+      lastBeatBlock_ = blocks_;
+    }
+    onsetAverage_ += (onset - onsetAverage_) * averageRise_;
+    lastOnset_ = onset;
+  }
+
+  const AudioFeatures& features() const { return features_; }
+
+  // Each band's power in the last block, before any normalizing
+  const float* energies() const { return energies_; }
+
+  // Blocks analyzed since the last reset
+  uint32_t blocks() const { return blocks_; }
+  float sampleRate() const { return sampleRate_; }
+
+  // Lowest frequency in a band (band == Bands gives the top of the last)
+  float bandHz(int band) const
+  {
+    return edges_[band] * sampleRate_ / BlockSize;
+  }
+
+  // The FFT on its own, for benchmarks
+  const FixedFft<Log2BlockSize>& fft() const { return fft_; }
+
+private:
+  FixedFft<Log2BlockSize> fft_;
+  float sampleRate_;
+  int16_t window_[BlockSize];
+  int16_t re_[BlockSize];
+  int16_t im_[BlockSize];
+  uint16_t edges_[Bands + 1];
+  float peakFall_;
+  float averageRise_;
+  float beatFall_;
+  uint32_t minBeatBlocks_;
+
+  AudioFeatures features_;
+  float energies_[Bands];
+  float peaks_[Bands];
+  float levelPeak_;
+  float lastBins_[BlockSize / 2];
+  float lastFlux_;
+  float onsetAverage_;
+  float lastOnset_;
+  uint32_t blocks_;
+  uint32_t lastBeatBlock_;
+};
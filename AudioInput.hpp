@@ -0,0 +1,149 @@
+#pragma once
+
+#include "AudioAnalyzer.hpp"
+
+#include <pico/stdlib.h>
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+
+#include <algorithm>
+#include <cstdint>
+
+// Samples one ADC input continuously into a RAM ring by DMA.
+//
+// The ADC free-runs at SampleRate and paces a DMA channel whose write address
+// wraps around the ring, so sampling takes no CPU time at all; read() copies
+// whole blocks out as signed 16-bit samples. Where the DMA has got to comes
+// from its remaining transfer count. A reader that falls behind skips to the
+// newest blocks rather than reading ones the DMA is overwriting.
+//
+// Expects an analog microphone module (e.g. MAX4466 or MAX9814) biased to
+// half of 3.3 V on GPIO 26, 27 or 28 (ADC inputs 0-2).
+class AudioInput
+{
+public:
+  static constexpr uint32_t SampleRate = AudioAnalyzer::DeviceSampleRate;
+  static constexpr uint FirstPin = 26;
+  static constexpr int Inputs = 3;
+
+  // 2048 samples, 128 ms. The DMA wraps its write address on this many bits,
+  // so the ring has to be aligned to its size.
+  static constexpr uint RingBits = 12;
+  static constexpr uint32_t RingSamples = (1u << RingBits) / sizeof(uint16_t);
+
+  AudioInput() = default;
+  AudioInput(const AudioInput&) = delete;
+  AudioInput& operator=(const AudioInput&) = delete;
+
+  ~AudioInput()
+  {
+    stop();
+  }
+
+  static uint pin(int input) { return FirstPin + (uint)input; }
+
+  // Start sampling an input, 0-2, in place of whatever was sampling before.
+  // On failure the input that was running carries on.
+  bool start(int input)
+  {
+    if (input < 0 || input >= Inputs)
+    {
+      return false;
+    }
+    // Claimed before the old channel is let go, so there is nothing to undo
+    int dma = dma_claim_unused_channel(false);
+    if (dma < 0)
+    {
+      return false;
+    }
+    stop();
+    dma_ = (uint)dma;
+    input_ = input;
+
+    adc_init();
+    adc_gpio_init(pin(input));
+    adc_select_input((uint)input);
+    // Each conversion to the FIFO raises DREQ; no error bit, full 12 bits
+    adc_fifo_setup(true, true, 1, false, false);
+    // The ADC takes 1 + div cycles of its 48 MHz clock per sample
+    adc_set_clkdiv(48000000.0f / SampleRate - 1.0f);
+
+    dma_channel_config config = dma_channel_get_default_config(dma_);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, RingBits);
+    channel_config_set_dreq(&config, DREQ_ADC);
+    dma_channel_configure(dma_, &config, ring_, &adc_hw->fifo, TransferCount, true);
+    read_ = 0;
+    adc_run(true);
+    return true;
+  }
+
+  void stop()
+  {
+    if (input_ < 0) return;
+    adc_run(false);
+    dma_channel_abort(dma_);
+    adc_fifo_drain();
+    dma_channel_unclaim(dma_);
+    // Hand the pin back as a plain GPIO, e.g. for a LED strip
+    gpio_init(pin(input_));
+    gpio_set_input_enabled(pin(input_), true);
+    input_ = -1;
+  }
+
+  bool active() const { return input_ >= 0; }
+  int input() const { return input_; }
+
+  // Blocks skipped because the reader fell behind
+  uint32_t dropped() const { return dropped_; }
+
+  // Copy the next size samples into block, centered on 0 and scaled to 16
+  // bits. If more than maxQueued blocks are waiting the older ones are
+  // skipped. Returns false if a whole block hasn't arrived yet.
+  bool read(int16_t* block, uint32_t size, uint32_t maxQueued)
+  {
+    if (input_ < 0) return false;
+    if (!dma_channel_is_busy(dma_))
+    {
+      // Every one of the transfers has run (about 3 days); carry on from the
+      // start of the ring
+      dma_channel_set_write_addr(dma_, ring_, false);
+      dma_channel_set_trans_count(dma_, TransferCount, true);
+      read_ = 0;
+      return false;
+    }
+    uint32_t written = TransferCount - dma_channel_hw_addr(dma_)->transfer_count;
+    uint32_t waiting = (written - read_) / size;
+    if (waiting == 0)
+    {
+      return false;
+    }
+    // Keep clear of the block the DMA is writing into
+    maxQueued = std::max<uint32_t>(1, std::min(maxQueued, RingSamples / size - 1));
+    if (waiting > maxQueued)
+    {
+      dropped_ += waiting - maxQueued;
+      read_ += (waiting - maxQueued) * size;
+    }
+    for (uint32_t i = 0; i < size; ++i)
+    {
+      uint16_t sample = ring_[(read_ + i) % RingSamples] & 0xFFF;
+      block[i] = (int16_t)(((int32_t)sample - 2048) * 16);
+    }
+    read_ += size;
+    return true;
+  }
+
+private:
+  static constexpr uint32_t TransferCount = 0xFFFFFFFF;
+
+  alignas(1 << RingBits) uint16_t ring_[RingSamples];
+  uint dma_ = 0;
+  int input_ = -1;
+  // Samples read, counted like the DMA's transfers
+  uint32_t read_ = 0;
+  uint32_t dropped_ = 0;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+// 8-bit blend kernels for fades and compositing.
+//
+// Weights are integers from 0 to BlendOne, so there is no float conversion
+// per LED (the M0+ has no FPU, and RGBColor::blend costs soft-float math per
+// channel). Red and blue are packed into one word 16 bits apart, so a single
+// multiply scales both and the products can't carry into each other; green
+// goes on its own. That's four multiplies per lerp instead of six.
+// dst may be the same buffer as either input.
+
+// Weight that selects all of the second input
+constexpr uint32_t BlendOne = 256;
+
+// Weight for a fraction from 0 to 1
+inline uint32_t blendWeight(float t)
+{
+  return (uint32_t)std::clamp(t * (float)BlendOne + 0.5f, 0.0f, (float)BlendOne);
+}
+
+namespace BlendDetail
+{
+  constexpr uint32_t LaneMask = 0x00FF00FF;
+  constexpr uint32_t LaneRound = 0x00800080;
+
+  inline uint32_t packRB(const RGBColor& c) { return ((uint32_t)c.R << 16) | c.B; }
+
+  // Each lane is at most 255 * 256 + 128, which fits its 16 bits
+  inline uint32_t lerpLanes(uint32_t a, uint32_t b, uint32_t t)
+  {
+    return ((a * (BlendOne - t) + b * t + LaneRound) >> 8) & LaneMask;
+  }
+
+  // Saturating per-lane add of b * t to a
+  inline uint32_t addLanes(uint32_t a, uint32_t b, uint32_t t)
+  {
+    uint32_t sum = a + (((b * t) >> 8) & LaneMask);
+    // A lane that went past 255 has bit 8 set: fill it back to 255
+    uint32_t over = (sum & 0x01000100) >> 8;
+    return (sum | (over * 0xFF)) & LaneMask;
+  }
+}
+
+// a + (b - a) * t, rounded
+inline RGBColor blendColor(const RGBColor& a, const RGBColor& b, uint32_t t)
+{
+  using namespace BlendDetail;
+  uint32_t rb = lerpLanes(packRB(a), packRB(b), t);
+  uint32_t g = lerpLanes(a.G, b.G, t);
+  return RGBColor{(uint8_t)(rb >> 16), (uint8_t)g, (uint8_t)rb};
+}
+
+// dst = a + (b - a) * t
+inline void blendBuffers(RGBColor* dst, const RGBColor* a, const RGBColor* b, int count, uint32_t t)
+{
+  using namespace BlendDetail;
+  const uint32_t s = BlendOne - t;
+  for (int i = 0; i < count; ++i)
+  {
+    uint32_t rb = ((packRB(a[i]) * s + packRB(b[i]) * t + LaneRound) >> 8) & LaneMask;
+    uint32_t g = (a[i].G * s + b[i].G * t + 0x80) >> 8;
+    dst[i] = RGBColor{(uint8_t)(rb >> 16), (uint8_t)g, (uint8_t)rb};
+  }
+}
+
+// dst = dst + src * t, clipped at full
+inline void addBuffers(RGBColor* dst, const RGBColor* src, int count, uint32_t t)
+{
+  using namespace BlendDetail;
+  for (int i = 0; i < count; ++i)
+  {
+    uint32_t rb = addLanes(packRB(dst[i]), packRB(src[i]), t);
+    uint32_t g = std::min<uint32_t>(dst[i].G + ((src[i].G * t) >> 8), 255);
+    dst[i] = RGBColor{(uint8_t)(rb >> 16), (uint8_t)g, (uint8_t)rb};
+  }
+}
+
+// Buffer versions, over the LEDs all the buffers have
+inline void blendBuffers(LEDBuffer& dst, const LEDBuffer& a, const LEDBuffer& b, uint32_t t)
+{
+  int count = (int)std::min({dst.size(), a.size(), b.size()});
+  blendBuffers(dst.data(), a.data(), b.data(), count, t);
+}
+
+inline void addBuffers(LEDBuffer& dst, const LEDBuffer& src, uint32_t t)
+{
+  int count = (int)std::min(dst.size(), src.size());
+  addBuffers(dst.data(), src.data(), count, t);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cpp/Color.hpp>
+
+#include <cmath>
+#include <cstdint>
+
+// Gamma, color balance and global brightness for one chain, folded into one
+// 256-entry table per channel so calibrating an LED is three table loads.
+//
+// The gamma curve is kept separately in 16-bit fixed point so a brightness or
+// balance change (e.g. holding the brightness button) only rescales the tables
+// with integer math; powf only runs when the gamma itself changes.
+//
+// For temporal dithering the tables are also built at 8.8 fixed point (r16,
+// g16, b16), keeping ditherBits fractional bits. The fraction is what the
+// 8-bit tables round away, and what collapses gradients at low brightness.
+class ChainCalibration
+{
+public:
+  // Rebuild whatever depends on changed inputs. Returns true if the tables changed.
+  bool update(Vec3f balance, float gamma, float brightness, int ditherBits)
+  {
+    bool gammaChanged = !valid_ || gamma != gamma_;
+    bool scaleChanged = gammaChanged || balance.X != balance_.X || balance.Y != balance_.Y ||
+                        balance.Z != balance_.Z || brightness != brightness_ || ditherBits != ditherBits_;
+    if (gammaChanged)
+    {
+      gamma_ = gamma;
+      buildCurve();
+    }
+    if (scaleChanged)
+    {
+      balance_ = balance;
+      brightness_ = brightness;
+      ditherBits_ = ditherBits;
+      buildTable(r, r16, balance.X * brightness);
+      buildTable(g, g16, balance.Y * brightness);
+      buildTable(b, b16, balance.Z * brightness);
+    }
+    valid_ = true;
+    return scaleChanged;
+  }
+
+  bool update(Vec3f balance, float gamma, float brightness)
+  {
+    return update(balance, gamma, brightness, ditherBits_);
+  }
+
+  // Same inputs, new brightness
+  bool update(float brightness)
+  {
+    return update(balance_, gamma_, brightness, ditherBits_);
+  }
+
+  Vec3f balance() const { return balance_; }
+  float gamma() const { return gamma_; }
+  float brightness() const { return brightness_; }
+  int ditherBits() const { return ditherBits_; }
+
+  // Force a full rebuild on the next update()
+  void invalidate()
+  {
+    valid_ = false;
+  }
+
+  RGBColor apply(const RGBColor& c) const
+  {
+    return RGBColor{r[c.R], g[c.G], b[c.B]};
+  }
+
+  uint8_t r[256];
+  uint8_t g[256];
+  uint8_t b[256];
+  uint16_t r16[256];
+  uint16_t g16[256];
+  uint16_t b16[256];
+
+private:
+  void buildCurve()
+  {
+    for (int i = 0; i < 256; ++i)
+    {
+      float v = std::pow((float)i / 255.0f, gamma_);
+      curve_[i] = (uint16_t)std::lround(v * 65535.0f);
+    }
+  }
+
+  void buildTable(uint8_t* table, uint16_t* table16, float scale)
+  {
+    if (scale < 0.0f) scale = 0.0f;
+    if (scale > 1.0f) scale = 1.0f;
+    // 255 * scale in Q8; curve (Q16) * scale (Q8) fits in 32 bits and the
+    // top byte is the rounded output
+    uint32_t scaleQ8 = (uint32_t)(scale * 255.0f * 256.0f);
+    uint16_t keepMask = (uint16_t)(0xFF00 | ((0xFF00 >> ditherBits_) & 0xFF));
+    for (int i = 0; i < 256; ++i)
+    {
+      uint32_t v = (uint32_t)curve_[i] * scaleQ8;
+      table[i] = (uint8_t)((v + (1u << 23)) >> 24);
+      table16[i] = (uint16_t)(((v + (1u << 15)) >> 16) & keepMask);
+    }
+  }
+
+  uint16_t curve_[256];
+  Vec3f balance_ {1.0f, 1.0f, 1.0f};
+  float gamma_ = 1.0f;
+  float brightness_ = 1.0f;
+  int ditherBits_ = 0;
+  bool valid_ = false;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "Blend.hpp"
+#include "Scene.hpp"
+
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+enum class BlendMode : uint8_t
+{
+  Alpha,  // overlay mixed over the scene at a fixed opacity
+  Add     // overlay added on top of the scene, clipping at full
+};
+
+// What the compositor draws
+struct Composition
+{
+  static constexpr int NoScene = -1;
+
+  int scene = 0;
+  // Scene layered on top, or NoScene
+  int overlay = NoScene;
+  BlendMode overlayMode = BlendMode::Alpha;
+  // 0 to BlendOne
+  uint32_t overlayOpacity = BlendOne;
+  // Seconds a scene change crossfades for, 0 to cut straight over
+  float fadeTime = 0.0f;
+};
+
+// Draws the current scene, crossfades to the next one when it changes and
+// layers an overlay scene on top.
+//
+// The current scene always draws straight into the output. While a fade is
+// running the incoming scene draws into a buffer of its own and is blended
+// over it, and an overlay likewise gets its own buffer. Those buffers are
+// only held while they're in use, so a lone scene costs no extra RAM. Each
+// layer is a separate scene table, so the same scene can be on two layers.
+//
+// Frames that blend anything are always redrawn in full: the output then
+// holds the mix, not the current scene's last frame.
+class Compositor
+{
+public:
+  // Draw the next frame. Returns false if the buffer was left alone because
+  // the frame would be the same as the last one. Whichever core renders
+  // should be the only one calling this.
+  bool render(LEDBuffer& buffer, const Composition& composition, float deltaTime, float param)
+  {
+    if (composition.scene < 0 || composition.scene >= SceneList::size())
+    {
+      return false;
+    }
+    changeScene(composition);
+    if (fading_)
+    {
+      fadeElapsed_ += deltaTime;
+      if (fadeElapsed_ >= composition.fadeTime)
+      {
+        finishFade();
+      }
+    }
+
+    Scene& base = *tables_[front_].active();
+    if (mixed_)
+    {
+      base.invalidate();
+    }
+    bool changed = base.update(buffer, deltaTime, param);
+    mixed_ = false;
+
+    if (fading_)
+    {
+      incoming_.resize(buffer.size());
+      tables_[front_ ^ 1].active()->update(incoming_, deltaTime, param);
+      blendBuffers(buffer, buffer, incoming_, blendWeight(fadeElapsed_ / composition.fadeTime));
+      mixed_ = true;
+    }
+
+    if (composition.overlay >= 0 && composition.overlay < SceneList::size())
+    {
+      overlay_.resize(buffer.size());
+      tables_[OverlayLayer].activate(composition.overlay).update(overlay_, deltaTime, param);
+      if (composition.overlayMode == BlendMode::Add)
+        addBuffers(buffer, overlay_, composition.overlayOpacity);
+      else
+        blendBuffers(buffer, buffer, overlay_, composition.overlayOpacity);
+      mixed_ = true;
+    }
+    else if (tables_[OverlayLayer].active())
+    {
+      tables_[OverlayLayer].deactivate();
+      release(overlay_);
+    }
+
+    return changed || mixed_;
+  }
+
+  // Something else drew into the output since the last render
+  void invalidate()
+  {
+    if (Scene* base = tables_[front_].active())
+    {
+      base->invalidate();
+    }
+  }
+
+  // Layout for every layer, after the LED count, offsets or layout changed.
+  // Only call while nothing is rendering.
+  void layout(const PixelMap* map)
+  {
+    PatternScene::Cache.clear();
+    for (SceneList& table : tables_)
+    {
+      table.layout(map);
+    }
+  }
+
+  // Destroy every layer's scene and free the layer buffers. The next render
+  // starts over without a fade.
+  void reset()
+  {
+    for (SceneList& table : tables_)
+    {
+      table.deactivate();
+    }
+    release(incoming_);
+    release(overlay_);
+    fading_ = false;
+    mixed_ = false;
+  }
+
+  bool fading() const { return fading_; }
+
+  // The scene on screen, or the one being faded to
+  int scene() const
+  {
+    return tables_[fading_ ? front_ ^ 1 : front_].activeIndex();
+  }
+
+private:
+  // Layers 0 and 1 take turns holding the current scene and the incoming one
+  static constexpr int OverlayLayer = 2;
+
+  static void release(LEDBuffer& buffer)
+  {
+    buffer.clear();
+    buffer.shrink_to_fit();
+  }
+
+  void changeScene(const Composition& composition)
+  {
+    SceneList& front = tables_[front_];
+    if (!front.active())
+    {
+      front.activate(composition.scene);
+      return;
+    }
+    if (composition.scene == scene())
+    {
+      return;
+    }
+    if (fading_ && composition.scene == front.activeIndex())
+    {
+      // Changed back before the fade finished: run it backwards from here.
+      // The scene going out last drew into the output, not the incoming buffer.
+      front_ ^= 1;
+      fadeElapsed_ = std::max(composition.fadeTime - fadeElapsed_, 0.0f);
+      tables_[front_ ^ 1].active()->invalidate();
+      return;
+    }
+    if (fading_)
+    {
+      // A third scene: cut to the one fading in and fade from that
+      finishFade();
+    }
+    if (composition.fadeTime <= 0.0f)
+    {
+      tables_[front_].activate(composition.scene);
+      return;
+    }
+    tables_[front_ ^ 1].activate(composition.scene);
+    fading_ = true;
+    fadeElapsed_ = 0.0f;
+  }
+
+  void finishFade()
+  {
+    tables_[front_].deactivate();
+    front_ ^= 1;
+    fading_ = false;
+    release(incoming_);
+    // Its last frame is in the incoming buffer, not the output
+    tables_[front_].active()->invalidate();
+  }
+
+  SceneList tables_[3];
+  int front_ = 0;
+  bool fading_ = false;
+  float fadeElapsed_ = 0.0f;
+  // The output holds a blend rather than the current scene's frame
+  bool mixed_ = false;
+  LEDBuffer incoming_;
+  LEDBuffer overlay_;
+};
+
+// Renders for the main loop, or core 1 when pipelined
+Compositor SceneCompositor;
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32 (the zlib/PNG one), bitwise so it needs no table. Pass the previous
+// result to continue over more data, 0 to start.
+inline uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+
+// The span of draw buffer LEDs written since the output last sent them.
+// Writes are merged into one [begin, end) span: scattered pokes over-report a
+// little, but the common cases (whole frames, single fills, streamed ranges)
+// stay exact and checking a chain against it is two compares.
+struct DirtyRange
+{
+  int begin = 0;
+  int end = 0;
+
+  bool empty() const { return begin >= end; }
+
+  void mark(int b, int e)
+  {
+    if (b >= e) return;
+    if (empty())
+    {
+      begin = b;
+      end = e;
+    }
+    else
+    {
+      begin = std::min(begin, b);
+      end = std::max(end, e);
+    }
+  }
+
+  void markAll()
+  {
+    begin = 0;
+    end = INT_MAX;
+  }
+
+  void clear()
+  {
+    begin = end = 0;
+  }
+
+  bool overlaps(int b, int e) const
+  {
+    return begin < e && b < end;
+  }
+};
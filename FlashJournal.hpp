@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Crc32.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Log-structured store for one struct in a ring of flash sectors.
+//
+// Every save appends a record rather than erasing and rewriting one sector,
+// so a sector is only erased when the log wraps into it: with N sectors that
+// hold R records each, each sector sees one erase per N * R saves. A record is
+// a header (magic, sequence number, length, CRC-32) and the payload, padded to
+// whole pages and aligned to a page.
+//
+// load() scans the pages for headers and takes the valid record with the
+// highest sequence. A record torn by a power cut fails its CRC, so the one
+// before it wins and nothing half-written is ever loaded. The payload length
+// is stored, so records from firmware with a shorter struct still load (the
+// struct's own version field says which fields they had).
+//
+// Saving is split into steps of one flash operation each (erase a sector or
+// program a page) so the caller can run them when it's safe, e.g. between
+// LED transmits. commit() runs them all at once.
+//
+// Flash is the backend: SectorSize, PageSize, size(), read(offset) returning
+// a pointer to the region's bytes, erase(sectorOffset) and
+// program(pageOffset, page), the last two returning false on failure. The
+// region needs at least two sectors so an erase never takes out the latest
+// record.
+template <typename T, typename Flash>
+class FlashJournal
+{
+public:
+  static_assert(std::is_trivially_copyable<T>::value, "journal records are raw bytes");
+
+  static constexpr uint32_t Magic = 0x4C4F474A;  // "JGOL"
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t length;
+    uint16_t reserved;
+    uint32_t crc;
+  };
+
+  static constexpr uint32_t RecordPages = (sizeof(Header) + sizeof(T) + Flash::PageSize - 1) / Flash::PageSize;
+  static constexpr uint32_t RecordSize = RecordPages * Flash::PageSize;
+  static_assert(RecordSize <= Flash::SectorSize, "record must fit in a sector");
+
+  FlashJournal(Flash& flash) : flash_(flash) {}
+
+  // Find the latest valid record and copy it into data. Returns false (and
+  // leaves data alone) if there isn't one. Also picks where the next record
+  // goes, so call it once before saving.
+  bool load(T& data)
+  {
+    bool found = false;
+    latest_ = NoRecord;
+    for (uint32_t offset = 0; offset + sizeof(Header) <= flash_.size(); offset += Flash::PageSize)
+    {
+      const Header* header = headerAt(offset);
+      if (header->magic != Magic || !valid(offset))
+      {
+        continue;
+      }
+      if (!found || (int32_t)(header->sequence - sequence_) > 0)
+      {
+        found = true;
+        sequence_ = header->sequence;
+        latest_ = offset;
+      }
+      // Records don't overlap, skip the rest of this one
+      offset += pagesFor(header->length) * Flash::PageSize - Flash::PageSize;
+    }
+    if (found)
+    {
+      const Header* header = headerAt(latest_);
+      std::memcpy(&data, flash_.read(latest_ + sizeof(Header)), std::min<size_t>(header->length, sizeof(T)));
+      next_ = latest_ + pagesFor(header->length) * Flash::PageSize;
+    }
+    else
+    {
+      sequence_ = 0;
+      next_ = 0;
+    }
+    loaded_ = true;
+    return found;
+  }
+
+  // Queue data to be written. Returns false if the latest record already
+  // holds exactly this, so there's nothing to do.
+  bool save(const T& data)
+  {
+    if (!busy() && latest_ != NoRecord && headerAt(latest_)->length == sizeof(T) &&
+        std::memcmp(flash_.read(latest_ + sizeof(Header)), &data, sizeof(T)) == 0)
+    {
+      return false;
+    }
+    if (busy())
+    {
+      // Written as soon as the one in progress is done
+      pending_ = data;
+      hasPending_ = true;
+      return true;
+    }
+    begin(data);
+    return true;
+  }
+
+  // A save is waiting for step() calls
+  bool busy() const
+  {
+    return page_ < RecordPages;
+  }
+
+  // Run the next flash operation of the save in progress, if any
+  void step()
+  {
+    if (!busy())
+    {
+      return;
+    }
+    if (eraseFirst_)
+    {
+      if (!flash_.erase(target_))
+      {
+        ++failures_;
+        return;
+      }
+      ++erases_;
+      eraseFirst_ = false;
+      return;
+    }
+    if (!flash_.program(target_ + page_ * Flash::PageSize, record_.data() + page_ * Flash::PageSize))
+    {
+      ++failures_;
+      return;
+    }
+    if (++page_ < RecordPages)
+    {
+      return;
+    }
+    if (valid(target_))
+    {
+      latest_ = target_;
+      sequence_ = headerAt(target_)->sequence;
+      next_ = target_ + RecordSize;
+    }
+    else
+    {
+      // Didn't read back: give up on this sector and write it again after it
+      ++failures_;
+      next_ = sectorOf(target_) + Flash::SectorSize;
+      T data;
+      std::memcpy(&data, record_.data() + sizeof(Header), sizeof(T));
+      begin(data);
+      return;
+    }
+    if (hasPending_)
+    {
+      hasPending_ = false;
+      save(pending_);
+    }
+  }
+
+  // Finish any save in progress right away
+  void commit()
+  {
+    // Bounded in case the flash keeps failing
+    for (int i = 0; i < 64 && busy(); ++i)
+    {
+      step();
+    }
+  }
+
+  uint32_t sequence() const { return sequence_; }
+  uint32_t erases() const { return erases_; }
+  uint32_t failures() const { return failures_; }
+
+private:
+  static constexpr uint32_t NoRecord = 0xFFFFFFFF;
+
+  static uint32_t pagesFor(uint32_t length)
+  {
+    return (sizeof(Header) + length + Flash::PageSize - 1) / Flash::PageSize;
+  }
+
+  static uint32_t sectorOf(uint32_t offset)
+  {
+    return offset - offset % Flash::SectorSize;
+  }
+
+  // CRC over the header (with crc zeroed) and the payload
+  static uint32_t recordCrc(const Header& header, const uint8_t* payload)
+  {
+    Header h = header;
+    h.crc = 0;
+    uint32_t crc = crc32(0, (const uint8_t*)&h, sizeof(Header));
+    return crc32(crc, payload, header.length);
+  }
+
+  const Header* headerAt(uint32_t offset) const
+  {
+    return (const Header*)flash_.read(offset);
+  }
+
+  bool valid(uint32_t offset) const
+  {
+    const Header* header = headerAt(offset);
+    return header->magic == Magic &&
+           sectorOf(offset) == sectorOf(offset + pagesFor(header->length) * Flash::PageSize - 1) &&
+           recordCrc(*header, flash_.read(offset + sizeof(Header))) == header->crc;
+  }
+
+  bool blank(uint32_t offset, uint32_t size) const
+  {
+    const uint8_t* bytes = flash_.read(offset);
+    return std::all_of(bytes, bytes + size, [](uint8_t b) { return b == 0xFF; });
+  }
+
+  // Stage a record and pick where it goes
+  void begin(const T& data)
+  {
+    if (!loaded_)
+    {
+      T scratch;
+      load(scratch);
+    }
+    Header header {Magic, sequence_ + 1, (uint16_t)sizeof(T), 0, 0};
+    record_.assign(RecordSize, 0xFF);
+    std::memcpy(record_.data() + sizeof(Header), &data, sizeof(T));
+    header.crc = recordCrc(header, record_.data() + sizeof(Header));
+    std::memcpy(record_.data(), &header, sizeof(Header));
+
+    // Next free spot in this sector, or the start of the next one (erased
+    // first, which drops the oldest records). A spot that isn't blank was
+    // torn by a power cut; it shares a sector with the latest record, so
+    // that sector can't be erased yet.
+    uint32_t target = next_ % flash_.size();
+    if (target % Flash::SectorSize != 0 &&
+        (sectorOf(target) != sectorOf(target + RecordSize - 1) || !blank(target, RecordSize)))
+    {
+      target = (sectorOf(target) + Flash::SectorSize) % flash_.size();
+    }
+    eraseFirst_ = target % Flash::SectorSize == 0;
+    target_ = target;
+    page_ = 0;
+  }
+
+  Flash& flash_;
+  std::vector<uint8_t> record_;
+  T pending_;
+  bool hasPending_ = false;
+  bool loaded_ = false;
+  bool eraseFirst_ = false;
+  uint32_t target_ = 0;
+  uint32_t page_ = RecordPages;
+  uint32_t latest_ = NoRecord;
+  uint32_t next_ = 0;
+  uint32_t sequence_ = 0;
+  uint32_t erases_ = 0;
+  uint32_t failures_ = 0;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <pico/stdlib.h>
+
+#include <algorithm>
+#include <cstdint>
+
+// Paces the main loop on an absolute timeline.
+//
+// Frame slots are laid out at fixed multiples of the frame period from an
+// anchor time, so time spent rendering and transmitting never accumulates as
+// drift. When a frame overruns its slot the missed slots are skipped and the
+// loop rejoins the timeline. If frames keep overrunning, the rate is lowered to
+// what the measured work time allows and raised back toward the target once
+// there is headroom again.
+//
+// The scheduling math takes timestamps as arguments so it can run anywhere;
+// waitForFrame() and frameDone() are the pico-timer wrappers the loop uses.
+class FrameScheduler
+{
+public:
+  // Longest delta time handed to scenes, so a long stall (flash write, bench)
+  // doesn't make animations jump
+  static constexpr float MaxDeltaTimeSec = 0.25f;
+  static constexpr float MinFps = 1.0f;
+  static constexpr float MaxFps = 240.0f;
+
+  FrameScheduler(float targetFps = 20.0f)
+  {
+    this->targetFps(targetFps);
+  }
+
+  void targetFps(float fps)
+  {
+    targetFps_ = std::min(std::max(fps, MinFps), MaxFps);
+    targetPeriodUs_ = (uint64_t)(1000000.0f / targetFps_);
+    periodUs_ = targetPeriodUs_;
+    anchored_ = false;
+  }
+
+  float targetFps() const { return targetFps_; }
+
+  // The rate actually being scheduled, lower than the target when frames
+  // don't fit the budget
+  float currentFps() const { return 1000000.0f / (float)periodUs_; }
+
+  // Average time from frame start to frameDone()
+  uint32_t averageWorkUs() const { return (uint32_t)(workAvgUs_ >> WorkAvgShift); }
+
+  // Number of frame slots skipped because the previous frame overran
+  uint32_t skippedFrames() const { return skippedFrames_; }
+
+  // Block until the next frame slot. Returns the real time since the previous
+  // frame started, in seconds.
+  float waitForFrame()
+  {
+    if (anchored_)
+    {
+      sleep_until(from_us_since_boot(nextFrameUs_));
+    }
+    return startFrame(time_us_64());
+  }
+
+  // Mark the end of the frame's work (render and transmit)
+  void frameDone()
+  {
+    endFrame(time_us_64());
+  }
+
+  float startFrame(uint64_t nowUs)
+  {
+    if (!anchored_)
+    {
+      // First frame, or the rate changed: start a new timeline here
+      anchored_ = true;
+      slotUs_ = nowUs;
+      lastStartUs_ = nowUs;
+      frameStartUs_ = nowUs;
+      return (float)periodUs_ / 1000000.0f;
+    }
+    slotUs_ = nextFrameUs_;
+    frameStartUs_ = nowUs;
+    float deltaTime = (float)(nowUs - lastStartUs_) / 1000000.0f;
+    lastStartUs_ = nowUs;
+    return std::min(deltaTime, MaxDeltaTimeSec);
+  }
+
+  void endFrame(uint64_t nowUs)
+  {
+    uint64_t workUs = nowUs - frameStartUs_;
+
+    // Exponential moving average of the work time, 1/8 weight per frame
+    if (workAvgUs_ == 0)
+      workAvgUs_ = workUs << WorkAvgShift;
+    else
+      workAvgUs_ += workUs - (workAvgUs_ >> WorkAvgShift);
+    adaptRate();
+
+    // Next slot on the timeline; skip any slots we've already blown through
+    nextFrameUs_ = slotUs_ + periodUs_;
+    if (nowUs > nextFrameUs_)
+    {
+      uint64_t missed = (nowUs - nextFrameUs_) / periodUs_ + 1;
+      skippedFrames_ += (uint32_t)missed;
+      nextFrameUs_ += missed * periodUs_;
+    }
+  }
+
+private:
+  static constexpr int WorkAvgShift = 3;
+
+  void adaptRate()
+  {
+    uint64_t avgWorkUs = workAvgUs_ >> WorkAvgShift;
+    // Leave 1/8 of the period as headroom for input and jitter
+    uint64_t neededUs = avgWorkUs + (avgWorkUs >> 3);
+    if (neededUs > periodUs_)
+    {
+      // Sustained overrun: drop to a rate the work fits in
+      periodUs_ = neededUs;
+    }
+    else if (periodUs_ > targetPeriodUs_ && neededUs < periodUs_ - (periodUs_ >> 3))
+    {
+      // Recovering: step back toward the target rate
+      periodUs_ = std::max(targetPeriodUs_, std::max(neededUs, periodUs_ - (periodUs_ >> 4)));
+    }
+  }
+
+  float targetFps_ = 20.0f;
+  uint64_t targetPeriodUs_ = 50000;
+  uint64_t periodUs_ = 50000;
+  uint64_t slotUs_ = 0;
+  uint64_t nextFrameUs_ = 0;
+  uint64_t lastStartUs_ = 0;
+  uint64_t frameStartUs_ = 0;
+  uint64_t workAvgUs_ = 0;
+  uint32_t skippedFrames_ = 0;
+  bool anchored_ = false;
+};
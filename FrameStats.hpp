@@ -0,0 +1,222 @@
+#pragma once
+
+#include <pico/stdlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+// Phases of the main loop that FrameStats times
+enum class FramePhase : uint8_t
+{
+  Input,     // serial commands or stream packets
+  Audio,     // analyzing the sampled audio
+  Buttons,
+  Autosave,
+  Render,    // the compositor, on whichever core renders
+  Sync,      // waiting for core 1 to hand over its frame
+  Transmit,  // calibrate, encode and start the DMA
+  Frame,     // all the work in the frame
+  Count
+};
+
+// Where the main loop's time goes.
+//
+// Each phase gets a min/avg/max and a histogram over a window of frames, one
+// second by default. When a window closes its numbers become the ones stats
+// reports, and the next starts empty, so they follow what the loop is doing
+// now. Histogram buckets are a quarter of a power of two wide, so the p99 is
+// within 25% at any scale.
+//
+// Timing a phase is a timer read and a few adds. Without LOGGING_ENABLED the
+// class is empty and every call compiles away.
+#ifdef LOGGING_ENABLED
+class FrameStats
+{
+public:
+  static constexpr bool Enabled = true;
+
+  struct Summary
+  {
+    uint32_t count = 0;
+    uint32_t minUs = 0;
+    uint32_t avgUs = 0;
+    uint32_t p99Us = 0;
+    uint32_t maxUs = 0;
+  };
+
+  static const char* name(FramePhase phase)
+  {
+    static const char* const names[] = {"input", "audio", "buttons", "autosave", "render", "sync", "transmit", "frame"};
+    return names[(int)phase];
+  }
+
+  // Start timing a frame; the first lap() measures from here
+  void frameStart()
+  {
+    lapUs_ = frameStartUs_ = time_us_32();
+  }
+
+  // The phase that just finished ran since the last lap
+  void lap(FramePhase phase)
+  {
+    uint32_t now = time_us_32();
+    record(phase, now - lapUs_);
+    lapUs_ = now;
+  }
+
+  // A phase timed somewhere else, e.g. on the other core
+  void record(FramePhase phase, uint32_t us)
+  {
+    Phase& p = current_[(int)phase];
+    p.minUs = p.count == 0 ? us : std::min(p.minUs, us);
+    p.maxUs = std::max(p.maxUs, us);
+    p.totalUs += us;
+    ++p.count;
+    ++p.buckets[bucket(us)];
+  }
+
+  // End the frame. missed is true if it overran its slot on the timeline.
+  // Returns true if that closed a window.
+  bool frameEnd(bool missed)
+  {
+    uint32_t now = time_us_32();
+    uint32_t frameUs = now - frameStartUs_;
+    record(FramePhase::Frame, frameUs);
+    worstFrameUs_ = std::max(worstFrameUs_, frameUs);
+    if (missed)
+    {
+      ++missed_;
+      ++windowMissed_;
+    }
+    if (now - windowStartUs_ < windowUs_)
+    {
+      return false;
+    }
+    for (int i = 0; i < (int)FramePhase::Count; ++i)
+    {
+      last_[i] = summarize(current_[i]);
+      current_[i] = Phase();
+    }
+    lastMissed_ = windowMissed_;
+    windowMissed_ = 0;
+    windowStartUs_ = now;
+    return true;
+  }
+
+  void windowUs(uint32_t us) { windowUs_ = std::max<uint32_t>(us, 1); }
+  uint32_t windowUs() const { return windowUs_; }
+
+  // The last closed window
+  const Summary& summary(FramePhase phase) const { return last_[(int)phase]; }
+  uint32_t windowMissed() const { return lastMissed_; }
+
+  // Since boot
+  uint32_t missed() const { return missed_; }
+  uint32_t worstFrameUs() const { return worstFrameUs_; }
+
+  void print(std::ostream& out) const
+  {
+    out << "Frame stats (last " << windowUs_ / 1000 << " ms, us):" << std::endl;
+    for (int i = 0; i < (int)FramePhase::Count; ++i)
+    {
+      const Summary& s = last_[i];
+      if (s.count == 0) continue;
+      out << "    " << name((FramePhase)i) << ":    n " << s.count << "    min " << s.minUs << "    avg " << s.avgUs
+          << "    p99 " << s.p99Us << "    max " << s.maxUs << std::endl;
+    }
+    out << "    missed deadlines:    " << lastMissed_ << " (" << missed_ << " since boot)" << std::endl;
+    out << "    worst frame since boot:    " << worstFrameUs_ << " us" << std::endl;
+  }
+
+  // One line per phase: stats,<phase>,<count>,<min>,<avg>,<p99>,<max>
+  // then stats,missed,<window>,<since boot>
+  void printCsv(std::ostream& out) const
+  {
+    for (int i = 0; i < (int)FramePhase::Count; ++i)
+    {
+      const Summary& s = last_[i];
+      out << "stats," << name((FramePhase)i) << "," << s.count << "," << s.minUs << "," << s.avgUs
+          << "," << s.p99Us << "," << s.maxUs << "\n";
+    }
+    out << "stats,missed," << lastMissed_ << "," << missed_ << std::endl;
+  }
+
+  // Histogram bucket for a time: exact below 8 us, then 4 per power of two
+  static int bucket(uint32_t us)
+  {
+    if (us < 8) return (int)us;
+    int log = 31 - __builtin_clz(us);
+    return std::min((log - 1) * 4 + (int)((us >> (log - 2)) & 3), Buckets - 1);
+  }
+
+  // Largest time that falls in a bucket
+  static uint32_t bucketMaxUs(int b)
+  {
+    if (b < 8) return (uint32_t)b;
+    int log = b / 4 + 1;
+    return ((uint32_t)(4 + b % 4 + 1) << (log - 2)) - 1;
+  }
+
+private:
+  // Up to about 2^31 us; anything longer lands in the last bucket
+  static constexpr int Buckets = 120;
+
+  struct Phase
+  {
+    uint32_t count = 0;
+    uint32_t minUs = 0;
+    uint32_t maxUs = 0;
+    uint64_t totalUs = 0;
+    uint16_t buckets[Buckets] = {};
+  };
+
+  static Summary summarize(const Phase& p)
+  {
+    Summary s;
+    if (p.count == 0) return s;
+    s.count = p.count;
+    s.minUs = p.minUs;
+    s.maxUs = p.maxUs;
+    s.avgUs = (uint32_t)(p.totalUs / p.count);
+    // First bucket with 99% of the samples at or below it
+    uint32_t target = p.count - p.count / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < Buckets; ++b)
+    {
+      seen += p.buckets[b];
+      if (seen >= target)
+      {
+        s.p99Us = std::min(bucketMaxUs(b), p.maxUs);
+        break;
+      }
+    }
+    return s;
+  }
+
+  Phase current_[(int)FramePhase::Count];
+  Summary last_[(int)FramePhase::Count];
+  uint32_t frameStartUs_ = 0;
+  uint32_t lapUs_ = 0;
+  uint32_t windowStartUs_ = 0;
+  uint32_t windowUs_ = 1000000;
+  uint32_t windowMissed_ = 0;
+  uint32_t lastMissed_ = 0;
+  uint32_t missed_ = 0;
+  uint32_t worstFrameUs_ = 0;
+};
+#else
+class FrameStats
+{
+public:
+  static constexpr bool Enabled = false;
+
+  void frameStart() {}
+  void lap(FramePhase) {}
+  void record(FramePhase, uint32_t) {}
+  bool frameEnd(bool) { return false; }
+  void windowUs(uint32_t) {}
+  void print(std::ostream&) const {}
+  void printCsv(std::ostream&) const {}
+};
+#endif
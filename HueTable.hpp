@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <cmath>
+#include <cstdint>
+
+// Integer-only hue to RGB conversion for the hue-based scenes.
+//
+// Hues are 16-bit fractions of a full turn (0x10000 == 360 degrees). Animated
+// hues are carried in a 32-bit accumulator whose upper 16 bits are the hue, so
+// stepping across a strip never drifts. Fully saturated colors come from a
+// 1536-entry table (6 sextants x 256 steps), which is exactly the resolution of
+// 8-bit HSV, so no precision is lost against HSVColor::toRGB().
+
+constexpr int HueTableSize = 1536;
+
+struct HueTableData
+{
+  uint8_t rgb[HueTableSize][3];
+};
+
+constexpr HueTableData makeHueTable()
+{
+  HueTableData table {};
+  for (int i = 0; i < HueTableSize; ++i)
+  {
+    uint8_t rise = (uint8_t)(i & 0xFF);
+    uint8_t fall = (uint8_t)(255 - rise);
+    uint8_t r = 0, g = 0, b = 0;
+    switch (i >> 8)
+    {
+      case 0: r = 255;  g = rise; b = 0;    break;
+      case 1: r = fall; g = 255;  b = 0;    break;
+      case 2: r = 0;    g = 255;  b = rise; break;
+      case 3: r = 0;    g = fall; b = 255;  break;
+      case 4: r = rise; g = 0;    b = 255;  break;
+      default: r = 255; g = 0;    b = fall; break;
+    }
+    table.rgb[i][0] = r;
+    table.rgb[i][1] = g;
+    table.rgb[i][2] = b;
+  }
+  return table;
+}
+
+inline constexpr HueTableData HueTable = makeHueTable();
+
+// Convert a hue in degrees (any range) to a 16-bit hue
+inline uint16_t hueFromDegrees(float degrees)
+{
+  return (uint16_t)(int32_t)std::lround(degrees * (65536.0f / 360.0f));
+}
+
+// Convert a hue as a fraction of a turn (0.0 - 1.0) to a 16-bit hue
+inline uint16_t hueFromUnit(float unit)
+{
+  return (uint16_t)(int32_t)std::lround(unit * 65536.0f);
+}
+
+// Fully saturated, full value color for a 16-bit hue
+inline RGBColor hueToRGB(uint16_t hue)
+{
+  // hue * 1536 / 65536
+  const uint8_t* c = HueTable.rgb[((uint32_t)hue * 3u) >> 7];
+  return RGBColor{c[0], c[1], c[2]};
+}
+
+// Integer HSV to RGB, saturation and value are 0 - 255. Within 1 LSB of
+// HSVColor::toRGB() for the same inputs.
+inline RGBColor hsvToRGB(uint16_t hue, uint8_t saturation, uint8_t value)
+{
+  const uint8_t* c = HueTable.rgb[((uint32_t)hue * 3u) >> 7];
+  uint32_t s = (uint32_t)saturation + 1;
+  uint32_t v = (uint32_t)value + 1;
+  uint32_t r = 255 - (((255 - c[0]) * s) >> 8);
+  uint32_t g = 255 - (((255 - c[1]) * s) >> 8);
+  uint32_t b = 255 - (((255 - c[2]) * s) >> 8);
+  return RGBColor{(uint8_t)((r * v) >> 8), (uint8_t)((g * v) >> 8), (uint8_t)((b * v) >> 8)};
+}
+
+// Fill a buffer with a rainbow. hue is a 32-bit turn accumulator (upper 16 bits
+// are the hue) and step is added per LED.
+inline void fillHueRamp(LEDBuffer& buffer, uint32_t hue, uint32_t step)
+{
+  RGBColor* out = buffer.data();
+  const int size = (int)buffer.size();
+  for (int i = 0; i < size; ++i)
+  {
+    const uint8_t* c = HueTable.rgb[((hue >> 16) * 3u) >> 7];
+    out[i] = RGBColor{c[0], c[1], c[2]};
+    hue += step;
+  }
+}
+
+// The float rainbow GamerRGB used before the table existed. Kept as the
+// baseline for the host and on-device benchmarks.
+inline void fillHueRampFloat(LEDBuffer& buffer, float baseHue)
+{
+  for (int i = 0; i < (int)buffer.size(); ++i)
+  {
+    float locationOffsetHue = (float)i * (360.0f / (float)buffer.size());
+    buffer[i] = HSVColor{ fmodf(baseHue + locationOffsetHue, 360.0f) , 1.0f, 1.0f }.toRGB();
+  }
+}
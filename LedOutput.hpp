@@ -0,0 +1,387 @@
+#pragma once
+
+#include "ChainCalibration.hpp"
+#include "DirtyRange.hpp"
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Where a chain's LEDs sit in the draw buffer
+struct ChainMapping
+{
+  int size = 0;
+  int offset = 0;
+  // The chain is wired from the far end, so its first LED is the last one
+  // in the draw buffer slice
+  bool reversed = false;
+};
+
+// Final stage of the frame: calibrates the draw buffer, encodes it for the
+// wire and starts the chains sending it.
+//
+// Each chain's slice of the draw buffer is passed through that chain's
+// ChainCalibration tables straight into the words its driver clocks out (GRB
+// in the upper 24 bits), so the only per-LED color math is the table lookup.
+// Chains may overlap in the draw buffer; each has its own word buffer and
+// calibration.
+//
+// Chains with dithering enabled use the 8.8 fixed-point tables instead and
+// carry each LED's fractional remainder into the next frame (temporal error
+// diffusion), so over a few frames the average output hits levels between
+// the WS2812B's 8-bit steps.
+//
+// Chains are only re-encoded and re-sent when the frame touched their LEDs, or
+// their calibration or mapping changed, so a static frame costs next to
+// nothing. Dithered chains go out every frame since their output keeps moving.
+//
+// The encode loop also totals the channel values it writes, which gives each
+// chain's current draw from the power model. A chain over its budget has its
+// brightness eased down over the next few frames (folded into its tables like
+// the global brightness) and eased back up once there's headroom.
+//
+// Chain is the driver (Ws2812bChain on the device, a mock on the host): it
+// is constructed from a pin and provides ok(), beginWrite(words, count),
+// isBusy() and waitComplete(). A chain without a pin has no driver and is
+// never sent.
+template <typename Chain>
+class LedOutput
+{
+public:
+  static constexpr int NoPin = -1;
+
+  // One chain per entry, driven from that pin (or NoPin)
+  LedOutput(const std::vector<int>& pins) :
+    chains_(pins.size()),
+    pins_(pins.size(), NoPin),
+    mappings_(pins.size()),
+    calibrations_(pins.size()),
+    residuals_(pins.size()),
+    words_(pins.size()),
+    encoded_(pins.size()),
+    stale_(pins.size(), true),
+    sums_(pins.size(), 0),
+    milliamps_(pins.size(), 0.0f),
+    budgets_(pins.size(), 0.0f),
+    powerScales_(pins.size(), 1.0f)
+  {
+    for (size_t c = 0; c < pins.size(); ++c)
+    {
+      pin((int)c, pins[c]);
+    }
+  }
+
+  std::vector<ChainMapping>& mappings() { return mappings_; }
+  Chain& chain(int chain) { return *chains_[chain]; }
+  int chainCount() const { return (int)chains_.size(); }
+  int pin(int chain) const { return pins_[chain]; }
+
+  // Move a chain to another pin, or detach it with NoPin. The driver is only
+  // recreated if the pin changed. Returns false if the driver couldn't get
+  // the hardware it needs, in which case the chain is left detached.
+  bool pin(int chain, int pin)
+  {
+    if (pin == pins_[chain])
+    {
+      return true;
+    }
+    // Release the old state machine before claiming a new one
+    if (chains_[chain])
+    {
+      chains_[chain]->waitComplete();
+      chains_[chain].reset();
+    }
+    pins_[chain] = NoPin;
+    stale_[chain] = true;
+    if (pin == NoPin)
+    {
+      return true;
+    }
+    auto driver = std::make_unique<Chain>((uint)pin);
+    if (!driver->ok())
+    {
+      return false;
+    }
+    chains_[chain] = std::move(driver);
+    pins_[chain] = pin;
+    return true;
+  }
+
+  // Chain writes skipped because nothing in them changed
+  uint32_t skippedWrites() const { return skippedWrites_; }
+
+  // Set a chain's gamma, color balance and how many fractional bits it
+  // dithers (0 to disable; more bits reach finer levels but need a higher frame
+  // rate to stay invisible). Tables are only rebuilt if these actually changed.
+  void calibration(int chain, Vec3f balance, float gamma, int ditherBits = 0)
+  {
+    calibration(chain, balance, gamma, ditherBits, brightness_);
+  }
+
+  // Same, with the brightness the next beginWrite() will use, so a change to
+  // both builds the tables once rather than twice
+  void calibration(int chain, Vec3f balance, float gamma, int ditherBits, float brightness)
+  {
+    brightness_ = brightness;
+    if (calibrations_[chain].update(balance, gamma, brightness * powerScales_[chain], ditherBits))
+    {
+      stale_[chain] = true;
+    }
+    if (ditherBits == 0)
+    {
+      residuals_[chain].clear();
+      residuals_[chain].shrink_to_fit();
+    }
+  }
+
+  // Current model: mA one channel draws at full (255) output, linear below
+  // that, and mA each LED draws when dark
+  void powerModel(float channelMilliamps, float idleMilliamps)
+  {
+    channelMilliamps_ = channelMilliamps;
+    idleMilliamps_ = idleMilliamps;
+  }
+
+  // Most current a chain may draw, or 0 for no limit
+  void powerBudget(int chain, float milliamps)
+  {
+    budgets_[chain] = milliamps;
+  }
+
+  float powerBudget(int chain) const { return budgets_[chain]; }
+
+  // Estimated draw of the frame last sent on a chain
+  float milliamps(int chain) const { return milliamps_[chain]; }
+
+  // Brightness factor the limiter applies to a chain, 1 when under budget
+  float powerScale(int chain) const { return powerScales_[chain]; }
+
+  // Encode the chains overlapping dirty and start sending them. Only blocks
+  // while the previous frame is still going out; the draw buffer is free
+  // again as soon as this returns.
+  void beginWrite(const LEDBuffer& drawBuffer, float brightness, const DirtyRange& dirty)
+  {
+    // No-op unless the brightness or a chain's power scale changed
+    brightness_ = brightness;
+    for (size_t c = 0; c < calibrations_.size(); ++c)
+    {
+      if (calibrations_[c].update(brightness * powerScales_[c]))
+      {
+        stale_[c] = true;
+      }
+    }
+
+    // The DMA is still reading the word buffers until every chain latches
+    waitComplete();
+
+    for (size_t c = 0; c < chains_.size(); ++c)
+    {
+      if (!chains_[c])
+      {
+        milliamps_[c] = 0.0f;
+        continue;
+      }
+      const int offset = mappings_[c].offset;
+      const bool reversed = mappings_[c].reversed;
+      const int size = std::max(0, std::min(mappings_[c].size, (int)drawBuffer.size() - offset));
+      std::vector<uint32_t>& words = words_[c];
+      const ChainCalibration& cal = calibrations_[c];
+      const RGBColor* in = drawBuffer.data() + offset;
+
+      // Only the dirty LEDs need encoding, unless the words are stale
+      int begin = std::max(dirty.begin - offset, 0);
+      int end = std::min(dirty.end - offset, size);
+      if (stale_[c] || (int)words.size() != size || encoded_[c].offset != offset || encoded_[c].reversed != reversed || cal.ditherBits() > 0)
+      {
+        begin = 0;
+        end = size;
+      }
+      else if (begin >= end)
+      {
+        ++skippedWrites_;
+        continue;
+      }
+      words.resize(size);
+      encoded_[c] = {size, offset, reversed};
+      stale_[c] = false;
+
+      // Reversed chains are written back to front
+      uint32_t* out = (reversed && size > 0) ? words.data() + size - 1 : words.data();
+      const int step = reversed ? -1 : 1;
+      if (cal.ditherBits() > 0)
+      {
+        sums_[c] = encodeDithered(cal, in, out, step, size, residuals_[c]);
+      }
+      else if (begin == 0 && end == size)
+      {
+        sums_[c] = encode<false>(cal, in, out, step, size);
+      }
+      else
+      {
+        sums_[c] += encode<true>(cal, in + begin, out + begin * step, step, end - begin);
+      }
+      chains_[c]->beginWrite(words.data(), words.size());
+      milliamps_[c] = idleMilliamps_ * size + channelMilliamps_ * (float)sums_[c] / 255.0f;
+      limitPower(c, size);
+    }
+  }
+
+  // Encode and send every chain
+  void beginWrite(const LEDBuffer& drawBuffer, float brightness)
+  {
+    DirtyRange all;
+    all.markAll();
+    beginWrite(drawBuffer, brightness, all);
+  }
+
+  bool isBusy() const
+  {
+    for (auto& chain : chains_)
+    {
+      if (chain && chain->isBusy()) return true;
+    }
+    return false;
+  }
+
+  void waitComplete() const
+  {
+    for (auto& chain : chains_)
+    {
+      if (chain) chain->waitComplete();
+    }
+  }
+
+  // Send a frame and wait until it has latched
+  void write(const LEDBuffer& drawBuffer, float brightness)
+  {
+    beginWrite(drawBuffer, brightness);
+    waitComplete();
+  }
+
+private:
+  static inline uint32_t word(uint32_t r, uint32_t g, uint32_t b)
+  {
+    return (g << 24) | (r << 16) | (b << 8);
+  }
+
+  // Sum of the three channels in a word
+  static inline uint32_t channels(uint32_t w)
+  {
+    return (w >> 24) + ((w >> 16) & 0xFF) + ((w >> 8) & 0xFF);
+  }
+
+  // Returns the sum of the channel values written. With Replace it's the
+  // change in the sum, less the words overwritten, so the chain's running
+  // total stays right when only part of it is encoded.
+  template <bool Replace>
+  static int32_t encode(const ChainCalibration& cal, const RGBColor* in, uint32_t* out, int step, int size)
+  {
+    int32_t sum = 0;
+    for (int i = 0; i < size; ++i, out += step)
+    {
+      uint32_t r = cal.r[in[i].R];
+      uint32_t g = cal.g[in[i].G];
+      uint32_t b = cal.b[in[i].B];
+      if (Replace) sum -= (int32_t)channels(*out);
+      sum += (int32_t)(r + g + b);
+      *out = word(r, g, b);
+    }
+    return sum;
+  }
+
+  static int32_t encodeDithered(const ChainCalibration& cal, const RGBColor* in, uint32_t* out, int step, int size, std::vector<uint8_t>& residual)
+  {
+    if ((int)residual.size() != size * 3)
+    {
+      residual.assign(size * 3, 0);
+    }
+    uint8_t* err = residual.data();
+    int32_t sum = 0;
+    for (int i = 0; i < size; ++i, err += 3, out += step)
+    {
+      // Table values top out at 255.0, so adding a fraction can't overflow
+      uint32_t r = cal.r16[in[i].R] + err[0];
+      uint32_t g = cal.g16[in[i].G] + err[1];
+      uint32_t b = cal.b16[in[i].B] + err[2];
+      *out = word(r >> 8, g >> 8, b >> 8);
+      sum += (int32_t)((r >> 8) + (g >> 8) + (b >> 8));
+      err[0] = (uint8_t)r;
+      err[1] = (uint8_t)g;
+      err[2] = (uint8_t)b;
+    }
+    return sum;
+  }
+
+  // Ease a chain's power scale toward what would bring the frame just sent
+  // within budget. The LEDs' draw is linear in the scale (it multiplies the
+  // tables after gamma), so one frame's estimate gives the scale directly.
+  // Down is fast, over a few frames; up is slower so a scene that hovers near
+  // the budget doesn't pump.
+  void limitPower(size_t c, int size)
+  {
+    float scale = powerScales_[c];
+    float target = 1.0f;
+    if (budgets_[c] > 0.0f)
+    {
+      float channelMa = milliamps_[c] - idleMilliamps_ * size;
+      float fullMa = scale > 0.0f ? channelMa / scale : channelMa;
+      float headroom = budgets_[c] - idleMilliamps_ * size;
+      if (headroom <= 0.0f)
+      {
+        target = 0.0f;
+      }
+      else if (channelMa > headroom)
+      {
+        target = headroom / fullMa;
+      }
+      else if (channelMa < headroom * PowerHoldBand)
+      {
+        target = std::min(1.0f, headroom / fullMa);
+      }
+      else
+      {
+        // Just under the budget: hold, since the tables round to 8 bits
+        // and the estimate jitters a little whenever the scale moves
+        target = scale;
+      }
+    }
+    scale += (target - scale) * (target < scale ? PowerDownRate : PowerUpRate);
+    // Settle rather than rebuild the tables for changes that can't be seen
+    if (std::abs(target - scale) < 1.0f / 256.0f)
+    {
+      scale = target;
+    }
+    powerScales_[c] = scale;
+  }
+
+  // Fraction of the way to the target scale covered per frame
+  static constexpr float PowerDownRate = 0.5f;
+  static constexpr float PowerUpRate = 0.1f;
+  // Fraction of the budget the draw must fall below before the scale rises
+  static constexpr float PowerHoldBand = 0.95f;
+
+  std::vector<std::unique_ptr<Chain>> chains_;
+  std::vector<int> pins_;
+  std::vector<ChainMapping> mappings_;
+  std::vector<ChainCalibration> calibrations_;
+  std::vector<std::vector<uint8_t>> residuals_;
+  std::vector<std::vector<uint32_t>> words_;
+  // Mapping the word buffers were last encoded for
+  std::vector<ChainMapping> encoded_;
+  std::vector<bool> stale_;
+  uint32_t skippedWrites_ = 0;
+
+  // Power estimate and limiter, per chain
+  std::vector<int32_t> sums_;
+  std::vector<float> milliamps_;
+  std::vector<float> budgets_;
+  std::vector<float> powerScales_;
+  float channelMilliamps_ = 20.0f;
+  float idleMilliamps_ = 1.0f;
+  float brightness_ = 1.0f;
+};
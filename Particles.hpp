@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Blend.hpp"
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// A point of light moving along the buffer, with an optional fading tail
+struct Particle
+{
+  // LEDs from the start of the buffer, and LEDs per second
+  float position = 0.0f;
+  float velocity = 0.0f;
+  // Brightness from 0 to 1, and how much of it goes per second. A particle
+  // is gone once it reaches 0.
+  float life = 1.0f;
+  float decay = 0.0f;
+  RGBColor color {0, 0, 0};
+  // LEDs trailing behind the head, dimming to nothing
+  uint8_t tail = 0;
+  // The LEDs it lit last frame, [drawnBegin, drawnEnd)
+  int16_t drawnBegin = 0;
+  int16_t drawnEnd = 0;
+};
+
+// Fixed-capacity pool of particles, drawn by touching only the LEDs they
+// cover.
+//
+// The particles are allocated once, on the heap, when the pool is built, so
+// a scene holding a pool stays small and the scene arena isn't sized by it.
+// Live particles are kept packed at the front: a dead one is replaced by the
+// last, so spawning, removing and stepping never allocate or search, and a
+// frame costs O(particles + LEDs they cover) whatever the buffer size. That
+// relies on the buffer still holding the last frame the pool drew; if
+// anything else drew over it, clear the buffer and draw() from scratch.
+// Particles that overlap add together, clipping at full.
+template <int Capacity>
+class ParticlePool
+{
+public:
+  static constexpr int capacity() { return Capacity; }
+  int size() const { return count_; }
+  bool full() const { return count_ == Capacity; }
+
+  Particle* begin() { return particles_.data(); }
+  Particle* end() { return particles_.data() + count_; }
+
+  // A new particle at rest, or null if the pool is full
+  Particle* spawn()
+  {
+    if (full()) return nullptr;
+    Particle& particle = particles_[count_++];
+    particle = Particle();
+    return &particle;
+  }
+
+  void clear()
+  {
+    count_ = 0;
+  }
+
+  // Erase what every particle drew last frame, move them on, drop the ones
+  // that faded out or left the buffer and draw the rest. Returns false if it
+  // didn't touch the buffer.
+  bool step(LEDBuffer& buffer, float deltaTime)
+  {
+    const int size = (int)buffer.size();
+    bool touched = false;
+    // Every erase before any draw, or one particle could erase another
+    for (int i = 0; i < count_; ++i)
+    {
+      const Particle& p = particles_[i];
+      int b = std::max<int>(p.drawnBegin, 0);
+      int e = std::min<int>(p.drawnEnd, size);
+      if (b < e)
+      {
+        std::fill(buffer.begin() + b, buffer.begin() + e, RGBColor{0, 0, 0});
+        touched = true;
+      }
+    }
+    for (int i = 0; i < count_;)
+    {
+      Particle& p = particles_[i];
+      p.position += p.velocity * deltaTime;
+      p.life -= p.decay * deltaTime;
+      if (p.life <= 0.0f || p.position < -(float)p.tail - 1.0f || p.position >= (float)(size + p.tail + 1))
+      {
+        p = particles_[--count_];
+        continue;
+      }
+      touched |= stamp(buffer, p);
+      ++i;
+    }
+    return touched;
+  }
+
+  // Draw every particle where it is, over whatever the buffer holds
+  bool draw(LEDBuffer& buffer)
+  {
+    bool touched = false;
+    for (int i = 0; i < count_; ++i)
+    {
+      touched |= stamp(buffer, particles_[i]);
+    }
+    return touched;
+  }
+
+private:
+  // Head at full brightness, the tail stepping down behind it (against the
+  // way it moves)
+  static bool stamp(LEDBuffer& buffer, Particle& p)
+  {
+    const int size = (int)buffer.size();
+    const int head = (int)std::floor(p.position);
+    const int dir = p.velocity < 0.0f ? 1 : -1;
+    const int tailEnd = head + dir * p.tail;
+    p.drawnBegin = (int16_t)std::max(std::min(head, tailEnd), 0);
+    p.drawnEnd = (int16_t)std::min(std::max(head, tailEnd) + 1, size);
+    if (p.drawnBegin >= p.drawnEnd)
+    {
+      return false;
+    }
+    const uint32_t weight = blendWeight(p.life);
+    const uint32_t length = p.tail + 1u;
+    for (uint32_t k = 0; k < length; ++k)
+    {
+      int led = head + dir * (int)k;
+      if (led < 0 || led >= size) continue;
+      addBuffers(&buffer[led], &p.color, 1, weight * (length - k) / length);
+    }
+    return true;
+  }
+
+  std::vector<Particle> particles_ = std::vector<Particle>(Capacity);
+  int count_ = 0;
+};
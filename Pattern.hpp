@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+// Fill a buffer by repeating its first period LEDs. The block copied doubles
+// each time, so it takes log2(size / period) copies and no per-LED divide.
+inline void repeatPeriod(LEDBuffer& buffer, int period)
+{
+  const int size = (int)buffer.size();
+  RGBColor* data = buffer.data();
+  for (int filled = std::min(period, size); filled > 0 && filled < size; filled *= 2)
+  {
+    std::copy(data, data + std::min(filled, size - filled), data + filled);
+  }
+}
+
+// The last few periods drawn by the pattern scenes, keyed by scene and a key
+// the scene derives from param (stripe spacing, color temperature...). A
+// scene that's switched back to, invalidated by a fade or overlay, or whose
+// param returns to an earlier value gets its period back without working it
+// out again. Periods don't depend on the buffer size, so that isn't part of
+// the key. Only whichever core renders may use it.
+class PatternCache
+{
+public:
+  static constexpr int Entries = 4;
+  // Longest period kept; longer ones are worked out every time
+  static constexpr int MaxPeriod = 64;
+
+  // The period stored for a scene and key, or null
+  const RGBColor* find(const char* scene, uint32_t key)
+  {
+    for (Entry& entry : entries_)
+    {
+      if (entry.scene == scene && entry.key == key)
+      {
+        entry.used = ++clock_;
+        ++hits_;
+        return entry.colors;
+      }
+    }
+    ++misses_;
+    return nullptr;
+  }
+
+  // Room for a period, in place of the least recently used one. Null if the
+  // period is too long to keep.
+  RGBColor* store(const char* scene, uint32_t key, int period)
+  {
+    if (period > MaxPeriod)
+    {
+      return nullptr;
+    }
+    Entry* oldest = &entries_[0];
+    for (Entry& entry : entries_)
+    {
+      if (entry.used < oldest->used) oldest = &entry;
+    }
+    oldest->scene = scene;
+    oldest->key = key;
+    oldest->used = ++clock_;
+    return oldest->colors;
+  }
+
+  void clear()
+  {
+    for (Entry& entry : entries_)
+    {
+      entry = Entry();
+    }
+  }
+
+  uint32_t hits() const { return hits_; }
+  uint32_t misses() const { return misses_; }
+
+private:
+  struct Entry
+  {
+    const char* scene = nullptr;
+    uint32_t key = 0;
+    uint32_t used = 0;
+    RGBColor colors[MaxPeriod];
+  };
+
+  Entry entries_[Entries];
+  uint32_t clock_ = 0;
+  uint32_t hits_ = 0;
+  uint32_t misses_ = 0;
+};
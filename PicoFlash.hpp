@@ -0,0 +1,65 @@
+#pragma once
+
+#include <pico/stdlib.h>
+#include <pico/flash.h>
+#include <hardware/flash.h>
+
+#include <cstdint>
+
+// A region of the pico's own flash, for FlashJournal.
+//
+// Erase and program go through flash_safe_execute, which pauses the other
+// core (it must have called multicore_lockout_victim_init()) and interrupts
+// while XIP is off. Reads come straight from the XIP window.
+class PicoFlash
+{
+public:
+  static constexpr uint32_t SectorSize = FLASH_SECTOR_SIZE;
+  static constexpr uint32_t PageSize = FLASH_PAGE_SIZE;
+
+  // Longest wait for the other core to pause
+  static constexpr uint32_t LockoutTimeoutMs = 100;
+
+  // offset is from the start of flash and sector aligned
+  PicoFlash(uint32_t offset, uint32_t sectors) : offset_(offset), size_(sectors * SectorSize) {}
+
+  uint32_t size() const { return size_; }
+
+  const uint8_t* read(uint32_t offset) const
+  {
+    return (const uint8_t*)(XIP_BASE + offset_ + offset);
+  }
+
+  bool erase(uint32_t offset)
+  {
+    Op op {offset_ + offset, nullptr};
+    return flash_safe_execute(doErase, &op, LockoutTimeoutMs) == PICO_OK;
+  }
+
+  bool program(uint32_t offset, const uint8_t* page)
+  {
+    Op op {offset_ + offset, page};
+    return flash_safe_execute(doProgram, &op, LockoutTimeoutMs) == PICO_OK;
+  }
+
+private:
+  struct Op
+  {
+    uint32_t offset;
+    const uint8_t* data;
+  };
+
+  static void doErase(void* param)
+  {
+    flash_range_erase(static_cast<Op*>(param)->offset, SectorSize);
+  }
+
+  static void doProgram(void* param)
+  {
+    Op* op = static_cast<Op*>(param);
+    flash_range_program(op->offset, op->data, PageSize);
+  }
+
+  uint32_t offset_;
+  uint32_t size_;
+};
@@ -1,34 +1,90 @@
+#include "Animation.hpp"
+#include "AudioAnalyzer.hpp"
+#include "AudioInput.hpp"
+#include "FlashJournal.hpp"
+#include "FrameScheduler.hpp"
+#include "FrameStats.hpp"
+#include "LedOutput.hpp"
+#include "PicoFlash.hpp"
+#include "Presets.hpp"
+#include "RenderPipeline.hpp"
 #include "Scene.hpp"
+#include "SerialTx.hpp"
 #include "Settings.hpp"
+#include "StreamProtocol.hpp"
+#include "Ws2812bChain.hpp"
 
 #include <cpp/BootSelButton.hpp>
 #include <cpp/Button.hpp>
 #include <cpp/Color.hpp>
 #include <cpp/CommandParser.hpp>
 #include <cpp/FlashStorage.hpp>
-#include <cpp/LedStripWs2812b.hpp>
 #include <cpp/Logging.hpp>
 
 #include <pico/stdlib.h>
 #include <pico/stdio.h>
 #include <pico/bootrom.h>
+#include <pico/multicore.h>
 #include <pico/unique_id.h>
 #include <hardware/watchdog.h>
+#include <hardware/clocks.h>
 
 #include <iostream>
 #include <cmath>
 #include <memory>
+#include <string>
 
-constexpr uint64_t TargetFPS = 20;
-constexpr uint64_t TargetFrameTimeUs = 1000000 / TargetFPS;
-constexpr float TargetFrameTimeSec = 1.0f / (float)TargetFPS;
+// Renders on core 1 when settings.pipelined is on
+RenderPipeline pipeline;
+
+void core1Main()
+{
+  // Lets core 0 pause this core while it writes flash
+  multicore_lockout_victim_init();
+  pipeline.runRenderer();
+}
+
+// Microphone on an ADC pin, when the audio command turns it on. The most
+// blocks analyzed per frame (16 ms each) bounds what the analysis can take
+// from the frame; a frame that runs long skips the older blocks.
+AudioInput audioInput;
+constexpr uint32_t MaxAudioBlocksPerFrame = 4;
+
+// Most stream bytes read per frame before the frame goes out anyway
+constexpr int StreamRxBudgetBytes = 64 * 1024;
+
+// Console output queued by std::cout, and the most of it sent per frame (about
+// what USB CDC moves in a 50 ms frame)
+SerialTx serialTx;
+constexpr size_t SerialTxBudgetBytes = 2048;
+
+// Settings journal: the sectors just below the last one, which FlashStorage
+// used for settings before the journal and is still read once to migrate them
+constexpr uint32_t JournalSectors = 8;
+constexpr uint32_t JournalOffset = PICO_FLASH_SIZE_BYTES - (JournalSectors + 1) * FLASH_SECTOR_SIZE;
+
+// Presets get their own journal below that; they change far less often
+constexpr uint32_t PresetSectors = 4;
+constexpr uint32_t PresetOffset = JournalOffset - PresetSectors * FLASH_SECTOR_SIZE;
+
+// Uploaded animation: from 1 MiB up to the presets. The firmware has to end
+// below it, which main() checks.
+constexpr uint32_t AnimationOffset = 1024 * 1024;
+constexpr uint32_t AnimationSectors = (PresetOffset - AnimationOffset) / FLASH_SECTOR_SIZE;
+
+// End of the firmware image in flash, from the linker script
+extern char __flash_binary_end;
+
+// Chains are resent at least this often even if nothing changed, so a strip
+// that glitched or was plugged in late catches up
+constexpr uint64_t KeepAliveUs = 1000000;
 
 inline float roundToInterval(float val, float interval)
 {
   return std::round(val / interval) * interval;
 }
 
-void rebootIntoProgMode(uint32_t displayBufferSize, std::vector<LedStripWs2812b::BufferMapping>& mappings)
+void rebootIntoProgMode(uint32_t displayBufferSize, LedOutput<Ws2812bChain>& output)
 {
   // Flash thru a rainbow to indicate programming mode
   LEDBuffer red(displayBufferSize);
@@ -39,19 +95,19 @@ void rebootIntoProgMode(uint32_t displayBufferSize, std::vector<LedStripWs2812b:
   }
 
   // Flash red 3x
-  LedStripWs2812b::writeColorsParallel(black, mappings, 0.5f);
+  output.write(black, 0.5f);
   sleep_until(make_timeout_time_ms(200));
-  LedStripWs2812b::writeColorsParallel(red, mappings, 0.5f);
+  output.write(red, 0.5f);
   sleep_until(make_timeout_time_ms(100));
-  LedStripWs2812b::writeColorsParallel(black, mappings, 0.5f);
+  output.write(black, 0.5f);
   sleep_until(make_timeout_time_ms(200));
-  LedStripWs2812b::writeColorsParallel(red, mappings, 0.5f);
+  output.write(red, 0.5f);
   sleep_until(make_timeout_time_ms(100));
-  LedStripWs2812b::writeColorsParallel(black, mappings, 0.5f);
+  output.write(black, 0.5f);
   sleep_until(make_timeout_time_ms(200));
-  LedStripWs2812b::writeColorsParallel(red, mappings, 0.5f);
+  output.write(red, 0.5f);
   sleep_until(make_timeout_time_ms(100));
-  LedStripWs2812b::writeColorsParallel(black, mappings, 0.5f);
+  output.write(black, 0.5f);
   sleep_until(make_timeout_time_ms(200));
 
   // Reboot
@@ -62,15 +118,43 @@ int main()
 {
   // Configure stdio
   stdio_init_all();
+  serialTx.install();
 
-  // Init the settings object
-  FlashStorage<Settings> settingsMgr;
-  Settings& settings = settingsMgr.data;
-  if (!settingsMgr.readFromFlash())
+  // Init the settings object from the latest journal record
+  PicoFlash journalFlash(JournalOffset, JournalSectors);
+  FlashJournal<Settings, PicoFlash> journal(journalFlash);
+  Settings settings;
+  if (journal.load(settings) && settings.versionSupported())
   {
-    settings.setDefaults();
+    settings.upgrade();
+  }
+  else
+  {
+    // Nothing journaled yet, try the single sector from older firmware, in a
+    // versioned layout and then the one before the chain table
+    FlashStorage<Settings> sectorMgr;
+    FlashStorage<SettingsV1> legacyMgr;
+    if (sectorMgr.readFromFlash() && sectorMgr.data.versionSupported())
+    {
+      settings = sectorMgr.data;
+      settings.upgrade();
+    }
+    else if (legacyMgr.readFromFlash())
+      settings.migrate(legacyMgr.data);
+    else
+      settings.setDefaults();
   }
   settings.validateAll();
+
+  PicoFlash presetFlash(PresetOffset, PresetSectors);
+  FlashJournal<PresetBank, PicoFlash> presetJournal(presetFlash);
+  PresetBank presets;
+  if (!presetJournal.load(presets) || presets.version != PresetBankVersion)
+  {
+    presets.clear();
+  }
+  int activePreset = -1;
+
   absolute_time_t dirtySaveTime = 0;
   absolute_time_t cooldownTimer = get_absolute_time();
 
@@ -85,10 +169,10 @@ int main()
     {
       if (ignoreCooldowns || (dirtySaveTime != 0 && time_reached(dirtySaveTime) && time_reached(cooldownTimer)))
       {
-        if (settingsMgr.writeToFlash())
+        if (journal.save(settings))
         {
-          DEBUG_LOG("Autosaved settings to flash!");
-          cooldownTimer = make_timeout_time_ms(15000);
+          DEBUG_LOG("Autosaving settings to flash!");
+          cooldownTimer = make_timeout_time_ms(5000);
         }
         dirtySaveTime = 0;
       }
@@ -96,27 +180,99 @@ int main()
   };
   
 
+  // The animation region, unless the firmware has grown into it
+  PicoFlash animationFlash(AnimationOffset, AnimationSectors);
+  AnimationWriter<PicoFlash> animationWriter(animationFlash);
+  const bool animationRegionFree = (uintptr_t)&__flash_binary_end - XIP_BASE <= AnimationOffset;
+  if (animationRegionFree)
+  {
+    FlashAnimation::Source = animationFlash.read(0);
+    FlashAnimation::SourceSize = animationFlash.size();
+  }
+
   // Setup the LED strip hardware
   LEDBuffer drawBuffer;
-  LedStripWs2812b chain0(22);
-  LedStripWs2812b chain1(26);
-  LedStripWs2812b chain2(27);
-  LedStripWs2812b chain3(28);
-  settings.updateCalibrations(chain0, chain1, chain2, chain3);
-  std::vector<LedStripWs2812b::BufferMapping> mappings { {&chain0}, {&chain1}, {&chain2}, {&chain3} };
+  LedOutput<Ws2812bChain> output(settings.chainPins());
+  std::vector<ChainMapping>& mappings = output.mappings();
+  settings.updateCalibrations(output);
+  settings.updatePower(output);
   settings.updateMappings(mappings, drawBuffer);
 
+  // Audio analysis for the audio scenes. The input stays off if a strip with
+  // LEDs has its pin.
+  AudioAnalyzer analyzer(AudioInput::SampleRate);
+  int16_t audioBlock[AudioAnalyzer::BlockSize];
+  auto chainOnPin = [&](uint pin)
+  {
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      if (settings.chains[i].count > 0 && settings.chains[i].pin == pin) return i;
+    }
+    return -1;
+  };
+  if (settings.audioInput >= 0 && chainOnPin(AudioInput::pin(settings.audioInput)) < 0)
+  {
+    audioInput.start(settings.audioInput);
+  }
+
+  // Spatial layout for the scenes. Coordinates set with the coord command
+  // override the settings until the next layout command; they're too big to
+  // keep in the settings sector so they don't survive a reboot.
+  PixelMap pixelMap;
+  std::vector<PixelMap::Point> coordinates;
+  bool layoutDirty = true;
+
   // Setup the buttons
   GPIOButton flashButton(16);
   GPIOButton paramButton(17, true);
   GPIOButton sceneBrightnessButton(18, true);
   GPIOButton sceneButton(19);
   GPIOButton brightnessButton(20, true);
+  GPIOButton presetButton(21);
   BootSelButton bootSelButton;
   
   // Setup other loop vars
   bool halt = false;
-  absolute_time_t nextFrameTime = get_absolute_time();
+  bool streaming = false;
+  bool core1Started = false;
+  FrameScheduler scheduler(settings.targetFps);
+  FrameStats stats;
+  bool statStreaming = false;
+  uint32_t skippedFrames = 0;
+
+  // LEDs changed since the last transmit, and whether the current scene's
+  // last output has been drawn over (so it must redraw even if unchanged)
+  DirtyRange dirty;
+  bool sceneStale = true;
+  uint64_t lastKeepAliveUs = 0;
+  auto bufferWritten = [&](int begin, int end)
+  {
+    dirty.mark(begin, end);
+    sceneStale = true;
+  };
+
+  // Finish any flash writes in progress, e.g. before a reboot
+  auto commitFlash = [&]()
+  {
+    output.waitComplete();
+    journal.commit();
+    presetJournal.commit();
+  };
+
+  // Switch to a preset's look in one go: the scene, param and brightness
+  // are all in place for the next render, and the calibration tables are
+  // built once, already at the new brightness
+  auto loadPreset = [&](int slot)
+  {
+    activePreset = slot;
+    bool recalibrate = presets.presets[slot].apply(settings);
+    settings.validateAll();
+    if (recalibrate)
+    {
+      settings.updateCalibrations(output);
+    }
+    markSettingsDirty();
+  };
 
   // With everything else setup, create the command parser
   CommandParser parser;
@@ -130,16 +286,36 @@ int main()
     std::cout << std::endl;
     std::cout << "Runtime Data:" << std::endl;
     std::cout << "    " << "status:    " << (halt ? "halted" : "running") << std::endl;
-    std::cout << "    " << "scene count:    " << Scenes.size() << std::endl;
+    std::cout << "    " << "render core:    " << (settings.pipelined && !halt ? 1 : 0) << std::endl;
+    std::cout << "    " << "scene count:    " << SceneList::size() << std::endl;
     std::cout << "    " << "scene names:";
-    for (auto& name : SceneNames) std::cout << "    " << name;
+    for (int s=0; s < SceneList::size(); ++s) std::cout << "    " << SceneList::name(s);
     std::cout << std::endl;
+    std::cout << "    " << "fading:    " << (SceneCompositor.fading() ? 1 : 0) << std::endl;
     std::cout << "    " << "draw buffer size:    " << drawBuffer.size() << std::endl;
     std::cout << "    " << "max draw buffer size:    " << MAX_BUFFER_LENGTH << std::endl;
-    std::cout << "    " << "target fps:    " << TargetFPS << std::endl;
-    std::cout;
+    std::cout << "    " << "target fps:    " << scheduler.targetFps() << std::endl;
+    std::cout << "    " << "current fps:    " << scheduler.currentFps() << std::endl;
+    std::cout << "    " << "avg frame work:    " << scheduler.averageWorkUs() << " us" << std::endl;
+    std::cout << "    " << "skipped frames:    " << scheduler.skippedFrames() << std::endl;
+    std::cout << "    " << "skipped chain writes:    " << output.skippedWrites() << std::endl;
+    std::cout << "    " << "serial tx stalls:    " << serialTx.stalls() << std::endl;
+    std::cout << "    " << "journal sequence:    " << journal.sequence() << std::endl;
+    std::cout << "    " << "journal erases:    " << journal.erases() << std::endl;
+    std::cout << "    " << "journal failures:    " << journal.failures() << std::endl;
+    std::cout << "    " << "active preset:    " << activePreset << std::endl;
   });
 
+  auto validChain = [&](int id)
+  {
+    if (id < 0 || id >= MaxChains)
+    {
+      std::cout << "error bad strip id" << std::endl;
+      return false;
+    }
+    return true;
+  };
+
   parser.addCommand("count", "[strip-id] [num-leds]", "Set number of LEDs per strip", [&](int id, uint32_t count)
   {
       if (count < 0 || count > MAX_BUFFER_LENGTH) 
@@ -147,17 +323,19 @@ int main()
         std::cout << "error bad count" << std::endl; 
         return false;
       }
-      switch (id)
+      if (!validChain(id)) return false;
+      if (count > 0 && audioInput.active() && settings.chains[id].pin == AudioInput::pin(audioInput.input()))
       {
-        case 0: settings.chain0Count = count; break;
-        case 1: settings.chain1Count = count; break;
-        case 2: settings.chain2Count = count; break;
-        case 3: settings.chain3Count = count; break;
-        default: std::cout << "error bad strip id" << std::endl; return false;
+        std::cout << "error pin used by the audio input" << std::endl;
+        return false;
       }
+      settings.chains[id].count = count;
 
       std::cout << "strip " << id << " count set: " << count << std::endl;
+      settings.updatePins(output);
       settings.updateMappings(mappings, drawBuffer);
+      bufferWritten(0, (int)drawBuffer.size());
+      layoutDirty = true;
       markSettingsDirty();
       return true;
   });
@@ -169,56 +347,216 @@ int main()
         std::cout << "error bad offset" << std::endl; 
         return false;
       }
-      switch (id)
+      if (!validChain(id)) return false;
+      settings.chains[id].offset = offset;
+      std::cout << "strip " << id << " offset set: " << offset << std::endl;
+      settings.updateMappings(mappings, drawBuffer);
+      bufferWritten(0, (int)drawBuffer.size());
+      layoutDirty = true;
+      markSettingsDirty();
+      return true;
+  });
+
+  parser.addCommand("pin", "[strip-id] [gpio]", "Set the GPIO a LED strip's data line is on", [&](int id, uint pin)
+  {
+      if (pin > 29)
       {
-        case 0: settings.chain0Offset = offset; break;
-        case 1: settings.chain1Offset = offset; break;
-        case 2: settings.chain2Offset = offset; break;
-        case 3: settings.chain3Offset = offset; break;
-        default: std::cout << "error bad strip id" << std::endl; return false;
+        std::cout << "error bad pin" << std::endl;
+        return false;
       }
-      std::cout << "strip " << id << " offset set: " << offset << std::endl;
+      if (!validChain(id)) return false;
+      for (int i = 0; i < MaxChains; ++i)
+      {
+        if (i != id && settings.chains[i].count > 0 && settings.chains[i].pin == pin)
+        {
+          std::cout << "error pin used by strip " << i << std::endl;
+          return false;
+        }
+      }
+      if (settings.chains[id].count > 0 && audioInput.active() && pin == AudioInput::pin(audioInput.input()))
+      {
+        std::cout << "error pin used by the audio input" << std::endl;
+        return false;
+      }
+      if (settings.chains[id].count > 0 && !output.pin(id, (int)pin))
+      {
+        // The old pin's state machine was let go first; take it back
+        output.pin(id, (int)settings.chains[id].pin);
+        std::cout << "error no free state machine for strip " << id << std::endl;
+        return false;
+      }
+      settings.chains[id].pin = pin;
+      std::cout << "strip " << id << " pin set: " << pin << std::endl;
+      markSettingsDirty();
+      return true;
+  });
+
+  parser.addCommand("reverse", "[strip-id] [0 or 1]", "Set whether a LED strip is wired from the far end", [&](int id, bool reversed)
+  {
+      if (!validChain(id)) return false;
+      settings.chainReversed[id] = reversed;
+      std::cout << "strip " << id << " reversed set: " << (reversed ? 1 : 0) << std::endl;
       settings.updateMappings(mappings, drawBuffer);
       markSettingsDirty();
       return true;
   });
 
+  parser.addCommand("layout", "[width] [height] [serpentine]", "Arrange the LEDs as a matrix (width 0 = line)", [&](uint width, uint height, bool serpentine)
+  {
+      if (width > PixelMap::MaxCells || height > PixelMap::MaxCells ||
+          !PixelMap::fits(std::max(width, 1u), std::max(height, 1u)))
+      {
+        std::cout << "error layout too big" << std::endl;
+        return false;
+      }
+      settings.layoutWidth = width;
+      settings.layoutHeight = height;
+      settings.serpentine = serpentine;
+      coordinates.clear();
+      layoutDirty = true;
+      std::cout << "layout set: " << width << " x " << height << (serpentine ? " serpentine" : "") << std::endl;
+      markSettingsDirty();
+      return true;
+  });
+
+  parser.addCommand("coord", "[index] [x] [y]", "Place one LED at a cell of a custom layout", [&](int i, uint x, uint y)
+  {
+      if (i < 0 || i >= drawBuffer.size() || x >= PixelMap::MaxCells || y >= PixelMap::MaxCells ||
+          !PixelMap::fits(x + 1, y + 1))
+      {
+        std::cout << "error invalid index or coordinate" << std::endl;
+        return false;
+      }
+      if (coordinates.size() != drawBuffer.size())
+      {
+        coordinates.assign(drawBuffer.size(), {0, 0});
+      }
+      coordinates[i] = {(uint16_t)x, (uint16_t)y};
+      layoutDirty = true;
+      return true;
+  });
+
   parser.addCommand("color", "[strip-id] [red-atten] [green-atten] [blue-atten]", "Set LED strip color balance", [&](int id, float r, float g, float b)
   {
-    switch (id)
-    {
-      case 0: settings.chain0ColorBalance = {r, g, b}; break;
-      case 1: settings.chain1ColorBalance = {r, g, b}; break;
-      case 2: settings.chain2ColorBalance = {r, g, b}; break;
-      case 3: settings.chain3ColorBalance = {r, g, b}; break;
-      default: std::cout << "error bad strip id" << std::endl; return;
-    }
+    if (!validChain(id)) return;
+    settings.chains[id].colorBalance = {r, g, b};
     std::cout << "chain " << id << " color balance set: " << r << ", " << g << ", " << b << std::endl;
-    settings.updateCalibrations(chain0, chain1, chain2, chain3);
+    settings.updateCalibrations(output);
     markSettingsDirty();
   });
   
   parser.addCommand("gamma", "[strip-id] [gamma]", "Set LED strip gamma correction", [&](int id, float gamma)
   {
-      switch (id)
+      if (!validChain(id)) return false;
+      settings.chains[id].gamma = gamma;
+      std::cout << "chain " << id << " gamma set: " << gamma << std::endl;
+      settings.updateCalibrations(output);
+      markSettingsDirty();
+      return true;
+  });
+
+  parser.addCommand("dither", "[strip-id] [bits]", "Set LED strip temporal dithering (0 = off)", [&](int id, int bits)
+  {
+      if (bits < 0 || bits > 8)
       {
-        case 0: settings.chain0Gamma = gamma; break;
-        case 1: settings.chain1Gamma = gamma; break;
-        case 2: settings.chain2Gamma = gamma; break;
-        case 3: settings.chain3Gamma = gamma; break;
-        default: std::cout << "error bad strip id" << std::endl; return false;
+        std::cout << "error bad dither bits" << std::endl;
+        return false;
       }
-      std::cout << "chain " << id << " gamma set: " << gamma << std::endl;
-      settings.updateCalibrations(chain0, chain1, chain2, chain3);
+      if (!validChain(id)) return false;
+      settings.chains[id].ditherBits = bits;
+      std::cout << "chain " << id << " dither bits set: " << bits << std::endl;
+      settings.updateCalibrations(output);
       markSettingsDirty();
       return true;
   });
 
+  parser.addCommand("powerbudget", "[strip-id] [milliamps]", "Limit a strip's estimated current draw (0 = no limit)", [&](int id, float milliamps)
+  {
+    if (!validChain(id)) return false;
+    if (milliamps < 0.0f)
+    {
+      std::cout << "error bad budget" << std::endl;
+      return false;
+    }
+    settings.powerBudget[id] = milliamps;
+    settings.updatePower(output);
+    std::cout << "chain " << id << " power budget set: " << milliamps << " mA" << std::endl;
+    markSettingsDirty();
+    return true;
+  });
+
+  parser.addCommand("powermodel", "[channel-ma] [idle-ma]", "Set the current one LED channel draws at full and one dark LED draws", [&](float channelMa, float idleMa)
+  {
+    if (channelMa <= 0.0f || channelMa > 100.0f || idleMa < 0.0f || idleMa > 10.0f)
+    {
+      std::cout << "error bad power model" << std::endl;
+      return false;
+    }
+    settings.channelMilliamps = channelMa;
+    settings.idleMilliamps = idleMa;
+    settings.updatePower(output);
+    std::cout << "power model set: " << channelMa << " mA/channel, " << idleMa << " mA/led idle" << std::endl;
+    markSettingsDirty();
+    return true;
+  });
+
+  parser.addCommand("power", "", "Print each strip's estimated current draw", [&]()
+  {
+    float total = 0.0f;
+    std::cout << "Power (estimated mA, last frame sent):" << std::endl;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      if (settings.chains[i].count == 0) continue;
+      total += output.milliamps(i);
+      std::cout << "    " << "chain" << i << ":    " << (int)output.milliamps(i) << " mA";
+      if (output.powerBudget(i) > 0.0f)
+      {
+        std::cout << "    budget " << (int)output.powerBudget(i) << " mA    scale " << output.powerScale(i);
+      }
+      std::cout << std::endl;
+    }
+    std::cout << "    " << "total:    " << (int)total << " mA" << std::endl;
+  });
+
   parser.addCommand("scene", "[scene-id]", "Change current lighting scene", [&](int scene)
   {
+    if (scene < 0 || scene >= SceneList::size())
+    {
+      std::cout << "error bad scene id" << std::endl;
+      return false;
+    }
     settings.scene = scene;
     std::cout << "scene set: " << settings.scene << std::endl;
     markSettingsDirty();
+    return true;
+  });
+
+  parser.addCommand("fade", "[seconds]", "Set how long scene changes crossfade for (0 = cut)", [&](float seconds)
+  {
+    if (seconds < 0.0f || seconds > 60.0f)
+    {
+      std::cout << "error bad fade time" << std::endl;
+      return false;
+    }
+    settings.fadeTime = seconds;
+    std::cout << "fade set: " << settings.fadeTime << std::endl;
+    markSettingsDirty();
+    return true;
+  });
+
+  parser.addCommand("overlay", "[scene-id] [mode] [opacity]", "Layer a scene on top (-1 = none; mode 0 = alpha, 1 = add)", [&](int scene, uint mode, float opacity)
+  {
+    if (scene < Composition::NoScene || scene >= SceneList::size() || mode > 1 || opacity < 0.0f || opacity > 1.0f)
+    {
+      std::cout << "error bad overlay scene, mode or opacity" << std::endl;
+      return false;
+    }
+    settings.overlay = scene;
+    settings.overlayMode = mode == 1 ? BlendMode::Add : BlendMode::Alpha;
+    settings.overlayOpacity = opacity;
+    std::cout << "overlay set: " << settings.overlay << " " << mode << " " << settings.overlayOpacity << std::endl;
+    markSettingsDirty();
+    return true;
   });
 
   parser.addCommand("brightness", "[brightness]", "Change maximum brightness", [&](float brightness)
@@ -235,6 +573,28 @@ int main()
     markSettingsDirty();
   });
 
+  parser.addCommand("fps", "[frames-per-second]", "Change the target frame rate", [&](float fps)
+  {
+    if (fps < FrameScheduler::MinFps || fps > FrameScheduler::MaxFps)
+    {
+      std::cout << "error bad fps" << std::endl;
+      return false;
+    }
+    settings.targetFps = fps;
+    scheduler.targetFps(fps);
+    std::cout << "fps set: " << settings.targetFps << std::endl;
+    markSettingsDirty();
+    return true;
+  });
+
+  parser.addCommand("pipeline", "[0 or 1]", "Render on core 1 while core 0 transmits", [&](bool pipelined)
+  {
+    settings.pipelined = pipelined;
+    if (!pipelined) pipeline.collect(drawBuffer);
+    std::cout << "pipeline set: " << (settings.pipelined ? 1 : 0) << std::endl;
+    markSettingsDirty();
+  });
+
   parser.addCommand("autosave", "[0 or 1]", "Enable/Disable autosave of settings", [&](bool autosave)
   {
     settings.autosave = autosave;
@@ -244,26 +604,89 @@ int main()
 
   parser.addCommand("defaults", "", "Restore all settings to their factory state", [&]()
   {
+    pipeline.collect(drawBuffer);
     settings.setDefaults();
+    settings.updatePins(output);
     settings.updateMappings(mappings, drawBuffer);
-    settings.updateCalibrations(chain0, chain1, chain2, chain3);
+    settings.updateCalibrations(output);
+    settings.updatePower(output);
+    bufferWritten(0, (int)drawBuffer.size());
+    coordinates.clear();
+    layoutDirty = true;
+    scheduler.targetFps(settings.targetFps);
     markSettingsDirty();
   });
   
   parser.addCommand("flash", "", "Save current settings to flash", [&]()
   {
-    // Write the settings to flash
-    if (settingsMgr.writeToFlash())
-      std::cout << "Wrote settings to flash!" << std::endl;
+    // Queue the settings, the main loop writes them between transmits
+    if (journal.save(settings))
+      std::cout << "Writing settings to flash!" << std::endl;
     else
       std::cout << "Skipped writing to flash because contents were already correct." << std::endl;
   });
 
+  parser.addCommand("presetsave", "[name] [calibration 0 or 1]", "Save scene, param and brightness (and calibration) as a preset", [&](std::string name, bool calibration)
+  {
+    if (name.empty() || name.size() > MaxPresetName)
+    {
+      std::cout << "error bad preset name" << std::endl;
+      return false;
+    }
+    int slot = presets.find(name.c_str());
+    if (slot < 0) slot = presets.freeSlot();
+    if (slot < 0)
+    {
+      std::cout << "error preset bank full" << std::endl;
+      return false;
+    }
+    presets.presets[slot].capture(name.c_str(), settings, calibration);
+    presetJournal.save(presets);
+    activePreset = slot;
+    std::cout << "preset " << slot << " saved: " << name << std::endl;
+    return true;
+  });
+
+  parser.addCommand("preset", "[name]", "Load a preset", [&](std::string name)
+  {
+    int slot = presets.find(name.c_str());
+    if (slot < 0)
+    {
+      std::cout << "error no such preset" << std::endl;
+      return false;
+    }
+    loadPreset(slot);
+    std::cout << "preset loaded: " << name << std::endl;
+    return true;
+  });
+
+  parser.addCommand("presets", "", "List the saved presets", [&]()
+  {
+    std::cout << "Presets:" << std::endl;
+    presets.print();
+  });
+
+  parser.addCommand("presetdelete", "[name]", "Delete a preset", [&](std::string name)
+  {
+    int slot = presets.find(name.c_str());
+    if (slot < 0)
+    {
+      std::cout << "error no such preset" << std::endl;
+      return false;
+    }
+    presets.presets[slot].name[0] = 0;
+    presetJournal.save(presets);
+    if (activePreset == slot) activePreset = -1;
+    std::cout << "preset deleted: " << name << std::endl;
+    return true;
+  });
+
   parser.addCommand("poke", "[index] [r] [g] [b]", "Set the RGB color of a single LED", [&](int i, uint r, uint g, uint b)
   {
     if (i >= 0 && i < drawBuffer.size())
     {
       drawBuffer[i] = {(uint8_t)r, (uint8_t)g, (uint8_t)b};
+      bufferWritten(i, i + 1);
     }
     else
     {
@@ -277,6 +700,7 @@ int main()
   parser.addCommand("fill", "[r] [g] [b]", "Set the RGB color all LEDs", [&](uint r, uint g, uint b)
   {
     std::fill(drawBuffer.begin(), drawBuffer.end(), RGBColor{(uint8_t)r, (uint8_t)g, (uint8_t)b});
+    bufferWritten(0, (int)drawBuffer.size());
   });
 
   parser.addCommand("fillr", "[begin] [end] [r] [g] [b]", "Set the RGB color value of LEDs within a range", [&](int begin, int end, uint r, uint g, uint b)
@@ -284,6 +708,7 @@ int main()
     if (begin >= 0 && begin < drawBuffer.size() && end >= 0 && end < drawBuffer.size() && begin <= end)
     {
       std::fill(drawBuffer.begin()+begin, drawBuffer.begin()+end, RGBColor{(uint8_t)r, (uint8_t)g, (uint8_t)b});
+      bufferWritten(begin, end);
     }
     else
     {
@@ -297,27 +722,273 @@ int main()
   {
     RGBColor color1{(uint8_t)r1, (uint8_t)g1, (uint8_t)b1};
     RGBColor color2{(uint8_t)r2, (uint8_t)g2, (uint8_t)b2};
+    uint32_t span = std::max<uint32_t>((uint32_t)drawBuffer.size() - 1, 1);
     for (int i=0; i < drawBuffer.size(); ++i)
     {
-      float t = (float) i / (float) (drawBuffer.size()-1);
-      drawBuffer[i] = RGBColor::blend(color1, color2, t);
+      drawBuffer[i] = blendColor(color1, color2, (uint32_t)i * BlendOne / span);
     }
+    bufferWritten(0, (int)drawBuffer.size());
   });
 
+  // Dumps go out a chunk per frame as the serial link keeps up
+  BufferDump bufferDump;
+
   parser.addCommand("dump", "", "Print the whole color buffer to stdout", [&]()
   {
-    std::cout << "Dumping display buffer..." << std::endl;
-    for (int i=0; i < drawBuffer.size(); ++i)
+    bufferDump.start(false);
+  });
+
+  parser.addCommand("dumphex", "", "Print the whole color buffer as compact hex", [&]()
+  {
+    bufferDump.start(true);
+  });
+
+  parser.addCommand("bench", "[frames]", "Time every scene and the hue kernels at the current LED count", [&](int frames)
+  {
+    if (frames <= 0 || drawBuffer.empty())
     {
-      std::cout << "idx " << i << " (" << (int)drawBuffer[i].R << " , " 
-                                       << (int)drawBuffer[i].G << " , " 
-                                       << (int)drawBuffer[i].B << " )" << std::endl;
+      std::cout << "error bad frame count or empty draw buffer" << std::endl;
+      return false;
     }
-    std::cout << "End of display buffer" << std::endl;
+
+    // Rendering is paused while this runs, so cycles/led is the pure kernel
+    // cost. The running scenes are dropped so only one is in memory at a time.
+    pipeline.waitIdle();
+    SceneCompositor.reset();
+    SceneList scenes;
+    scenes.layout(&pixelMap);
+    float cyclesPerUs = (float)clock_get_hz(clk_sys) / 1000000.0f;
+    float leds = (float)frames * (float)drawBuffer.size();
+    auto report = [&](const std::string& name, uint64_t elapsedUs)
+    {
+      std::cout << "    " << name << ":    " << (float)elapsedUs / (float)frames << " us/frame    "
+                << (float)elapsedUs * cyclesPerUs / leds << " cycles/led" << std::endl;
+    };
+
+    std::cout << "Benchmarking " << frames << " frames at " << drawBuffer.size() << " leds..." << std::endl;
+    for (int s=0; s < SceneList::size(); ++s)
+    {
+      Scene& scene = scenes.activate(s);
+      uint64_t start = time_us_64();
+      for (int f=0; f < frames; ++f)
+      {
+        // Time the full redraw, not the unchanged-frame shortcut
+        scene.invalidate();
+        scene.update(drawBuffer, 1.0f / settings.targetFps, settings.param);
+      }
+      report(SceneList::name(s), time_us_64() - start);
+    }
+
+    uint64_t start = time_us_64();
+    for (int f=0; f < frames; ++f)
+    {
+      fillHueRampFloat(drawBuffer, (float)f);
+    }
+    report("float HSV ramp", time_us_64() - start);
+
+    start = time_us_64();
+    uint32_t step = (uint32_t)(0x100000000ull / drawBuffer.size());
+    for (int f=0; f < frames; ++f)
+    {
+      fillHueRamp(drawBuffer, (uint32_t)hueFromDegrees((float)f) << 16, step);
+    }
+    report("fixed-point hue ramp", time_us_64() - start);
+
+    LEDBuffer other(drawBuffer.size());
+    start = time_us_64();
+    for (int f=0; f < frames; ++f)
+    {
+      float t = (float)(f & 255) / 255.0f;
+      for (int i=0; i < drawBuffer.size(); ++i)
+      {
+        drawBuffer[i] = RGBColor::blend(drawBuffer[i], other[i], t);
+      }
+    }
+    report("float blend", time_us_64() - start);
+
+    start = time_us_64();
+    for (int f=0; f < frames; ++f)
+    {
+      blendBuffers(drawBuffer, drawBuffer, other, (uint32_t)f & (BlendOne - 1));
+    }
+    report("packed blend", time_us_64() - start);
+    bufferWritten(0, (int)drawBuffer.size());
+    return true;
+  });
+
+  StreamDecoder streamDecoder;
+  uint8_t streamRx[512];
+  int streamRxPos = 0;
+  int streamRxLen = 0;
+
+  parser.addCommand("stream", "", "Switch to binary frame streaming (halts scenes)", [&]()
+  {
+    pipeline.collect(drawBuffer);
+    halt = true;
+    streaming = true;
+    streamDecoder.reset();
+    streamRxPos = streamRxLen = 0;
+    std::cout << "streaming " << drawBuffer.size() << std::endl;
+  });
+
+  // Write an animation upload into flash as it streams in
+  auto processUpload = [&](StreamDecoder::Event event)
+  {
+    // Flash is off while it's written, so no chain can be mid-transmit, and
+    // nothing may be playing the image while it changes
+    output.waitComplete();
+    pipeline.waitIdle();
+    if (event == StreamDecoder::Event::UploadBegin)
+    {
+      SceneCompositor.reset();
+      if (!animationRegionFree || !animationWriter.begin(streamDecoder.uploadValue()))
+      {
+        std::cout << "upload failed 0" << std::endl;
+      }
+    }
+    else if (event == StreamDecoder::Event::UploadData)
+    {
+      animationWriter.write(streamDecoder.uploadData(), streamDecoder.uploadBytes());
+    }
+    else
+    {
+      bool ok = animationWriter.end(streamDecoder.uploadValue());
+      // The next activation reads the new image
+      SceneCompositor.reset();
+      std::cout << (ok ? "upload ok " : "upload failed ") << animationWriter.received() << std::endl;
+    }
+  };
+
+  // Feed stream bytes into the draw buffer until a frame is committed, the
+  // host goes quiet or the per-frame budget runs out
+  auto processStream = [&]()
+  {
+    int budget = StreamRxBudgetBytes;
+    while (true)
+    {
+      if (streamRxPos == streamRxLen)
+      {
+        if (budget <= 0) return;
+        int n = stdio_get_until((char*)streamRx, sizeof(streamRx), get_absolute_time());
+        if (n <= 0) return;
+        streamRxPos = 0;
+        streamRxLen = n;
+        budget -= n;
+      }
+      StreamDecoder::Event event;
+      streamRxPos += streamDecoder.feed(streamRx + streamRxPos, streamRxLen - streamRxPos, drawBuffer, event);
+      DirtyRange streamed = streamDecoder.takeDirty();
+      bufferWritten(streamed.begin, streamed.end);
+      if (event == StreamDecoder::Event::Commit) return;
+      if (event == StreamDecoder::Event::UploadBegin || event == StreamDecoder::Event::UploadData ||
+          event == StreamDecoder::Event::UploadEnd)
+      {
+        processUpload(event);
+        continue;
+      }
+      if (event == StreamDecoder::Event::Exit)
+      {
+        streaming = false;
+        std::cout << "stream ended: " << streamDecoder.framesCommitted() << " frames, "
+                  << streamDecoder.droppedPackets() << " dropped packets, "
+                  << streamDecoder.rejectedPackets() << " rejected packets" << std::endl;
+        return;
+      }
+    }
+  };
+
+  parser.addCommand("anim", "", "Print the uploaded animation's size and frame rate", [&]()
+  {
+    if (!animationRegionFree)
+    {
+      std::cout << "error firmware overlaps the animation region" << std::endl;
+      return false;
+    }
+    AnimationImage image(FlashAnimation::Source, FlashAnimation::SourceSize);
+    if (!image.valid())
+    {
+      std::cout << "no animation, " << animationFlash.size() << " bytes free" << std::endl;
+      return true;
+    }
+    std::cout << "animation: " << image.frames() << " frames, " << image.leds() << " leds, " << image.fps() << " fps, "
+              << animationFlash.size() << " bytes of flash" << std::endl;
+    return true;
+  });
+
+  parser.addCommand("audio", "[adc-input]", "Sample a microphone on ADC input 0-2 (GPIO 26-28) for the audio scenes (-1 = off)", [&](int input)
+  {
+    if (input < -1 || input >= AudioInput::Inputs)
+    {
+      std::cout << "error bad adc input" << std::endl;
+      return false;
+    }
+    if (input >= 0)
+    {
+      int chain = chainOnPin(AudioInput::pin(input));
+      if (chain >= 0)
+      {
+        std::cout << "error pin used by strip " << chain << std::endl;
+        return false;
+      }
+    }
+    if (input < 0)
+    {
+      audioInput.stop();
+    }
+    else if (!audioInput.start(input))
+    {
+      std::cout << "error no free dma channel" << std::endl;
+      return false;
+    }
+    analyzer.reset();
+    settings.audioInput = input;
+    std::cout << "audio set: " << input << std::endl;
+    markSettingsDirty();
+    return true;
+  });
+
+  parser.addCommand("audiolevels", "", "Print the latest audio analysis", [&]()
+  {
+    const AudioFeatures& features = analyzer.features();
+    std::cout << "Audio:" << std::endl;
+    std::cout << "    " << "input:    " << audioInput.input() << std::endl;
+    std::cout << "    " << "blocks:    " << analyzer.blocks() << " (" << audioInput.dropped() << " dropped)" << std::endl;
+    std::cout << "    " << "level:    " << features.level << std::endl;
+    std::cout << "    " << "beats:    " << features.beats << std::endl;
+    for (int b = 0; b < AudioFeatures::Bands; ++b)
+    {
+      std::cout << "    " << "band" << b << " (" << (int)analyzer.bandHz(b) << "-" << (int)analyzer.bandHz(b + 1)
+                << " Hz):    " << features.bands[b] << std::endl;
+    }
+  });
+
+  parser.addCommand("stats", "", "Print how long each part of the main loop takes", [&]()
+  {
+    if (!FrameStats::Enabled)
+    {
+      std::cout << "error built without LOGGING_ENABLED" << std::endl;
+      return false;
+    }
+    stats.print(std::cout);
+    return true;
+  });
+
+  parser.addCommand("statstream", "[seconds]", "Print frame stats as CSV every few seconds (0 = off)", [&](float seconds)
+  {
+    if (!FrameStats::Enabled || seconds < 0.0f || seconds > 60.0f)
+    {
+      std::cout << "error bad interval or built without LOGGING_ENABLED" << std::endl;
+      return false;
+    }
+    statStreaming = seconds > 0.0f;
+    stats.windowUs(statStreaming ? (uint32_t)(seconds * 1000000.0f) : 1000000);
+    std::cout << "statstream set: " << seconds << std::endl;
+    return true;
   });
 
   parser.addCommand("halt", "", "Stop scenes, allow manual drawing", [&]()
   {
+    pipeline.collect(drawBuffer);
     halt = true;
   });
 
@@ -329,29 +1000,49 @@ int main()
   parser.addCommand("reboot", "", "Reboot the microcontroller right away", [&]()
   {
     tryAutosave(true);
+    commitFlash();
+    serialTx.flush();
     watchdog_reboot(0,0,0);
   });
   
   parser.addCommand("prog", "", "Reboot to pi pico bootloader for firmware programming", [&]()
   {
     tryAutosave(true);
+    commitFlash();
     std::cout << "Rebooting into programming mode..." << std::endl;
-    rebootIntoProgMode(drawBuffer.size(), mappings);
+    serialTx.flush();
+    rebootIntoProgMode(drawBuffer.size(), output);
   });
 
+  int renderedScene = -1;
+  bool renderedPipelined = settings.pipelined;
+  bool renderedHalt = halt;
   while (1)
   {
-    // Wait
-    sleep_until(nextFrameTime);
-    nextFrameTime = make_timeout_time_us(TargetFrameTimeUs);
+    // Wait for the next slot on the frame timeline
+    float deltaTime = scheduler.waitForFrame();
+    stats.frameStart();
 
     // Process input
-    parser.processStdIo();
+    if (streaming)
+      processStream();
+    else
+      parser.processStdIo();
+    bufferDump.pump(drawBuffer, std::cout, serialTx.space());
+    serialTx.pump(SerialTxBudgetBytes);
+    stats.lap(FramePhase::Input);
+
+    // Analyze the blocks the ADC sampled since the last frame
+    for (uint32_t i = 0; i < MaxAudioBlocksPerFrame && audioInput.read(audioBlock, AudioAnalyzer::BlockSize, MaxAudioBlocksPerFrame); ++i)
+    {
+      analyzer.process(audioBlock);
+    }
+    stats.lap(FramePhase::Audio);
 
     sceneButton.update();
     if (sceneButton.buttonUp())
     {
-      settings.scene = (settings.scene + 1) % (int)Scenes.size();
+      settings.scene = (settings.scene + 1) % SceneList::size();
       DEBUG_LOG("scene set: " << settings.scene);
       markSettingsDirty();
     }
@@ -359,7 +1050,7 @@ int main()
     paramButton.update();
     if (paramButton.heldActivate())
     {
-      float param = settings.param + (0.2f * TargetFrameTimeSec);
+      float param = settings.param + (0.2f * deltaTime);
       if (param > 1.0f ) param = 0.0f;
       settings.param = param;
       markSettingsDirty();
@@ -376,7 +1067,7 @@ int main()
     brightnessButton.update();
     if (brightnessButton.heldActivate())
     {
-      float brightness = settings.brightness - (0.2f * TargetFrameTimeSec);
+      float brightness = settings.brightness - (0.2f * deltaTime);
       if (brightness < 0.0f ) brightness = 1.0f;
       settings.brightness = brightness;
       markSettingsDirty();
@@ -393,23 +1084,34 @@ int main()
     sceneBrightnessButton.update();
     if (sceneBrightnessButton.heldActivate())
     {
-      float brightness = settings.brightness - (0.2f * TargetFrameTimeSec);
+      float brightness = settings.brightness - (0.2f * deltaTime);
       if (brightness < 0 ) brightness = 1.0f;
       settings.brightness = brightness;
       markSettingsDirty();
     }
     if (sceneBrightnessButton.buttonUp())
     {
-      settings.scene = (settings.scene + 1) % (int)Scenes.size();
+      settings.scene = (settings.scene + 1) % SceneList::size();
       DEBUG_LOG("scene set: " << settings.scene);
       markSettingsDirty();
     }
 
+    presetButton.update();
+    if (presetButton.buttonUp())
+    {
+      int slot = presets.next(activePreset);
+      if (slot >= 0)
+      {
+        loadPreset(slot);
+        DEBUG_LOG("preset loaded: " << presets.presets[slot].name);
+      }
+    }
+
     flashButton.update();
     if (flashButton.buttonUp())
     {
-      if (settingsMgr.writeToFlash())
-        DEBUG_LOG("Wrote settings to flash!");
+      if (journal.save(settings))
+        DEBUG_LOG("Writing settings to flash!");
       else
         DEBUG_LOG("Skipped writing to flash because contents were already correct.");
     }
@@ -418,17 +1120,109 @@ int main()
     if (bootSelButton.pressed())
     {
       tryAutosave(true);
-      rebootIntoProgMode(drawBuffer.size(), mappings);
+      commitFlash();
+      rebootIntoProgMode(drawBuffer.size(), output);
     }
 
+    stats.lap(FramePhase::Buttons);
+
     // If configured to autosave, try to write settings to flash
     // every frame. It'll only actually do it if the flash payload
-    // has changed and even then only once every 15 seconds.
+    // has changed and even then only once every 5 seconds.
     tryAutosave();
 
+    // One flash operation per frame for a save in progress. Flash is off
+    // while it runs, so only start it once the last transmit is done; it's
+    // over before this frame's transmit starts.
+    if (journal.busy() || presetJournal.busy())
+    {
+      output.waitComplete();
+      if (journal.busy())
+        journal.step();
+      else
+        presetJournal.step();
+    }
+    stats.lap(FramePhase::Autosave);
+
+    // Recompile the layout once per frame at most, however many commands
+    // changed it. The renderer must not be reading the old one.
+    if (layoutDirty)
+    {
+      pipeline.waitIdle();
+      if (coordinates.size() != drawBuffer.size() || !pixelMap.coordinates(coordinates))
+      {
+        settings.updateLayout(pixelMap, drawBuffer);
+      }
+      SceneCompositor.layout(&pixelMap);
+      layoutDirty = false;
+    }
+
+    // A different scene, render core or resuming from halt means the draw
+    // buffer doesn't hold the scene's last output
+    if (settings.scene != renderedScene || settings.pipelined != renderedPipelined || halt != renderedHalt)
+    {
+      sceneStale = true;
+      renderedScene = settings.scene;
+      renderedPipelined = settings.pipelined;
+      renderedHalt = halt;
+    }
+
     // Update and draw
-    if (!halt) Scenes[settings.scene]->update(drawBuffer, TargetFrameTimeSec, settings.param);
-    LedStripWs2812b::writeColorsParallel(drawBuffer, mappings, settings.brightness);
+    if (settings.pipelined && !halt)
+    {
+      if (!core1Started)
+      {
+        multicore_launch_core1(core1Main);
+        // Flash writes can only pause core 1 once it has signed up for the
+        // lockout; before that it would keep running from flash with XIP off
+        while (!multicore_lockout_victim_is_initialized(1))
+        {
+          tight_loop_contents();
+        }
+        core1Started = true;
+      }
+      // Show the frame core 1 rendered during the last transmit, then
+      // start it on the next one while this one goes out on the wire
+      bool rendered = pipeline.pending();
+      if (pipeline.collect(drawBuffer)) dirty.markAll();
+      stats.lap(FramePhase::Sync);
+      if (rendered) stats.record(FramePhase::Render, pipeline.renderUs());
+      pipeline.post({settings.composition(), deltaTime, settings.param, (uint32_t)drawBuffer.size(), sceneStale, analyzer.features()});
+      sceneStale = false;
+    }
+    else
+    {
+      if (pipeline.collect(drawBuffer)) dirty.markAll();
+      if (!halt)
+      {
+        if (sceneStale) SceneCompositor.invalidate();
+        sceneStale = false;
+        AudioScene::Input = analyzer.features();
+        if (SceneCompositor.render(drawBuffer, settings.composition(), deltaTime, settings.param)) dirty.markAll();
+        stats.lap(FramePhase::Render);
+      }
+    }
+
+    uint64_t nowUs = time_us_64();
+    if (nowUs - lastKeepAliveUs >= KeepAliveUs)
+    {
+      dirty.markAll();
+      lastKeepAliveUs = nowUs;
+    }
+
+    // Returns once the changed chains are encoded; the DMA sends them while
+    // the next frame's input and rendering run
+    output.beginWrite(drawBuffer, settings.brightness, dirty);
+    dirty.clear();
+    stats.lap(FramePhase::Transmit);
+    scheduler.frameDone();
+
+    bool missed = scheduler.skippedFrames() != skippedFrames;
+    skippedFrames = scheduler.skippedFrames();
+    if (stats.frameEnd(missed) && statStreaming && !streaming)
+    {
+      stats.printCsv(std::cout);
+    }
   }
   return 0;
 }
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Where each draw buffer LED sits in 2D.
+//
+// The draw buffer stays in wiring order; the map describes it as a
+// width x height raster. It is compiled once whenever the layout changes into
+// two tables: x()/y() give each LED's cell, and index() gives the LED at a
+// cell (or NoLed for cells nothing is wired to). Scenes read the tables in
+// their inner loops instead of working out the wiring per pixel.
+//
+// Layouts:
+// - line: x = LED index, y = 0 (what every scene assumed before). No tables
+//   are built, scenes check isLine() and use their plain 1D loop.
+// - matrix: rows of width LEDs starting top-left, optionally serpentine
+//   (every other row wired right to left)
+// - coordinates: an arbitrary cell per LED, e.g. measured from a photo
+class PixelMap
+{
+public:
+  static constexpr uint16_t NoLed = 0xFFFF;
+
+  // Largest raster, so a stray coordinate can't eat all the RAM
+  static constexpr int MaxCells = 16384;
+
+  struct Point
+  {
+    uint16_t x;
+    uint16_t y;
+  };
+
+  void line(int size)
+  {
+    x_.clear();
+    y_.clear();
+    index_.clear();
+    x_.shrink_to_fit();
+    y_.shrink_to_fit();
+    index_.shrink_to_fit();
+    size_ = size;
+    width_ = size;
+    height_ = 1;
+    isLine_ = true;
+  }
+
+  // LEDs past width * height are left off the raster at (0, 0). Returns
+  // false (and changes nothing) if the raster would be too big.
+  bool matrix(int size, int width, int height, bool serpentine)
+  {
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+    if (!fits(width, height))
+    {
+      return false;
+    }
+    size_ = size;
+    x_.assign(size, 0);
+    y_.assign(size, 0);
+    for (int i = 0; i < std::min(size, width * height); ++i)
+    {
+      int row = i / width;
+      int col = i % width;
+      x_[i] = (uint16_t)((serpentine && (row & 1)) ? width - 1 - col : col);
+      y_[i] = (uint16_t)row;
+    }
+    build(width, height);
+    return true;
+  }
+
+  bool coordinates(const std::vector<Point>& points)
+  {
+    int width = 1;
+    int height = 1;
+    for (const Point& p : points)
+    {
+      width = std::max(width, p.x + 1);
+      height = std::max(height, p.y + 1);
+    }
+    if (!fits(width, height))
+    {
+      return false;
+    }
+    size_ = (int)points.size();
+    x_.resize(points.size());
+    y_.resize(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+      x_[i] = points[i].x;
+      y_[i] = points[i].y;
+    }
+    build(width, height);
+    return true;
+  }
+
+  int size() const { return size_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // True if x is the LED index and there's a single row. The tables below
+  // are only there when this is false.
+  bool isLine() const { return isLine_; }
+
+  const uint16_t* x() const { return x_.data(); }
+  const uint16_t* y() const { return y_.data(); }
+
+  // LED at a cell, NoLed if none. Cells are row-major.
+  uint16_t index(int x, int y) const { return index_[y * width_ + x]; }
+  const uint16_t* raster() const { return index_.data(); }
+
+  // True if a raster of width by height cells (both at least 1) is within
+  // MaxCells. Checked per dimension, so a huge width or height can't wrap
+  // the product back under the limit.
+  static bool fits(int width, int height)
+  {
+    return width <= MaxCells && height <= MaxCells / width;
+  }
+
+private:
+  void build(int width, int height)
+  {
+    width_ = width;
+    height_ = height;
+    index_.assign(width * height, NoLed);
+    isLine_ = false;
+    for (size_t i = 0; i < x_.size(); ++i)
+    {
+      // When several LEDs share a cell the first one wins
+      uint16_t& cell = index_[y_[i] * width + x_[i]];
+      if (cell == NoLed) cell = (uint16_t)i;
+    }
+  }
+
+  std::vector<uint16_t> x_;
+  std::vector<uint16_t> y_;
+  std::vector<uint16_t> index_;
+  int size_ = 0;
+  int width_ = 0;
+  int height_ = 0;
+  bool isLine_ = true;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Settings.hpp"
+
+#include <cstring>
+#include <iostream>
+
+constexpr int MaxPresets = 8;
+
+// Longest preset name, not counting the terminator
+constexpr int MaxPresetName = 15;
+
+// What a preset remembers of one chain's calibration
+struct PresetCalibration
+{
+  Vec3f colorBalance;
+  float gamma;
+  int ditherBits;
+};
+
+// A named look: scene, param and brightness, and optionally every chain's
+// calibration. An empty name marks a free slot.
+struct Preset
+{
+  char name[MaxPresetName + 1];
+  int scene;
+  float brightness;
+  float param;
+  bool hasCalibration;
+  PresetCalibration chains[MaxChains];
+
+  bool used() const
+  {
+    return name[0] != 0;
+  }
+
+  // Take the look from the current settings
+  void capture(const char* presetName, const Settings& settings, bool calibration)
+  {
+    std::memset(this, 0, sizeof(*this));
+    std::strncpy(name, presetName, MaxPresetName);
+    scene = settings.scene;
+    brightness = settings.brightness;
+    param = settings.param;
+    hasCalibration = calibration;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      const ChainSettings& chain = settings.chains[i];
+      chains[i] = {chain.colorBalance, chain.gamma, chain.ditherBits};
+    }
+  }
+
+  // Write the look into settings. Returns true if the calibration changed,
+  // so the caller knows to rebuild the tables (once, for every chain).
+  bool apply(Settings& settings) const
+  {
+    settings.scene = scene;
+    settings.brightness = brightness;
+    settings.param = param;
+    if (!hasCalibration)
+    {
+      return false;
+    }
+    bool changed = false;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      ChainSettings& chain = settings.chains[i];
+      const PresetCalibration& saved = chains[i];
+      changed |= chain.colorBalance.X != saved.colorBalance.X || chain.colorBalance.Y != saved.colorBalance.Y ||
+                 chain.colorBalance.Z != saved.colorBalance.Z || chain.gamma != saved.gamma ||
+                 chain.ditherBits != saved.ditherBits;
+      chain.colorBalance = saved.colorBalance;
+      chain.gamma = saved.gamma;
+      chain.ditherBits = saved.ditherBits;
+    }
+    return changed;
+  }
+};
+
+// Bump when the layout below changes
+constexpr uint32_t PresetBankVersion = 1;
+
+// Every preset slot, saved as one record in its own flash journal so the
+// settings autosave doesn't rewrite them
+struct PresetBank
+{
+  uint32_t version;
+  Preset presets[MaxPresets];
+
+  void clear()
+  {
+    std::memset(this, 0, sizeof(*this));
+    version = PresetBankVersion;
+  }
+
+  // Slot holding name, or -1
+  int find(const char* name) const
+  {
+    for (int i = 0; i < MaxPresets; ++i)
+    {
+      if (presets[i].used() && std::strncmp(presets[i].name, name, MaxPresetName + 1) == 0)
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  // First free slot, or -1 if the bank is full
+  int freeSlot() const
+  {
+    for (int i = 0; i < MaxPresets; ++i)
+    {
+      if (!presets[i].used()) return i;
+    }
+    return -1;
+  }
+
+  // The next used slot after slot, wrapping around, or -1 if none are used
+  int next(int slot) const
+  {
+    for (int i = 1; i <= MaxPresets; ++i)
+    {
+      int s = (slot + i + MaxPresets) % MaxPresets;
+      if (presets[s].used()) return s;
+    }
+    return -1;
+  }
+
+  void print() const
+  {
+    for (int i = 0; i < MaxPresets; ++i)
+    {
+      const Preset& p = presets[i];
+      if (!p.used()) continue;
+      std::cout << "    " << i << ": " << p.name << "    scene " << p.scene << "    brightness " << p.brightness
+                << "    param " << p.param << (p.hasCalibration ? "    calibration" : "") << std::endl;
+    }
+  }
+};
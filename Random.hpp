@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Small xorshift32 generator for scenes that want noise.
+//
+// Each scene owns one, so seeding it doesn't disturb any other scene and a
+// scene replays the same sequence every time it's activated. Shifts and xors
+// only: no libc lock, no 64-bit multiply and no float divide, which all cost
+// on the M0+. Not for anything that needs real randomness.
+class Random
+{
+public:
+  constexpr explicit Random(uint32_t seed = DefaultSeed) : state_(seed ? seed : DefaultSeed) {}
+
+  // Restart the sequence. xorshift can't leave 0, so 0 picks the default.
+  void seed(uint32_t seed)
+  {
+    state_ = seed ? seed : DefaultSeed;
+  }
+
+  uint32_t next()
+  {
+    uint32_t x = state_;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state_ = x;
+    return x;
+  }
+
+  // Uniform in [min, max], for spans up to 65536. Scales the top 16 bits
+  // rather than taking a modulo, so there's no divide.
+  int range(int min, int max)
+  {
+    uint32_t span = (uint32_t)(max - min) + 1;
+    return min + (int)(((next() >> 16) * span) >> 16);
+  }
+
+  // Batched draw for filling a table in one go
+  void fill(uint32_t* out, size_t count)
+  {
+    uint32_t x = state_;
+    for (size_t i = 0; i < count; ++i)
+    {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      out[i] = x;
+    }
+    state_ = x;
+  }
+
+private:
+  static constexpr uint32_t DefaultSeed = 2463534242u;
+
+  uint32_t state_;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Compositor.hpp"
+
+#include <cpp/LedStripWs2812b.hpp>
+#include <pico/stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+// Double-buffered render/transmit pipeline.
+//
+// The main loop (core 0) owns the draw buffer and transmits it. The renderer
+// (core 1 on the pico, a std::thread on the host) owns a back buffer and renders
+// the next frame into it while the draw buffer is on the wire. When the frame is
+// collected it is copied into the draw buffer. The back buffer keeps it too, so
+// scenes that only redraw what changed (FlashAnimation, the particle scenes)
+// carry on from their last frame.
+//
+// Handoff is lock-free: core 0 publishes a job by bumping posted_, the renderer
+// publishes the result by copying that sequence number into finished_. Whoever
+// holds the "turn" owns the job and the back buffer, and the release/acquire
+// pair on the counters orders the buffer writes. Only plain atomic loads and
+// stores are used, which the M0+ supports without locks.
+class RenderPipeline
+{
+public:
+  struct Job
+  {
+    Composition composition;
+    float deltaTime = 0.0f;
+    float param = 0.0f;
+    uint32_t size = 0;
+    // The last output is gone from the back buffer (see Compositor::invalidate)
+    bool invalidate = false;
+    // For the audio scenes
+    AudioFeatures audio;
+  };
+
+  // True while the renderer is working on a job
+  bool busy() const
+  {
+    return finished_.load(std::memory_order_acquire) != posted_.load(std::memory_order_relaxed);
+  }
+
+  // True if a job was posted and not yet collected
+  bool pending() const
+  {
+    return pending_;
+  }
+
+  // Hand a frame to the renderer. Must not be called while busy().
+  void post(const Job& job)
+  {
+    job_ = job;
+    pending_ = true;
+    posted_.store(posted_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Wait for the renderer to go idle
+  void waitIdle() const
+  {
+    while (busy())
+    {
+      tight_loop_contents();
+    }
+  }
+
+  // Wait for the posted job and copy its output into drawBuffer. Returns false
+  // (and leaves drawBuffer alone) if nothing was pending, the scene reported
+  // an unchanged frame or the buffer was resized while the job was in flight.
+  bool collect(LEDBuffer& drawBuffer)
+  {
+    if (!pending_)
+    {
+      return false;
+    }
+    waitIdle();
+    pending_ = false;
+    if (!changed_ || back_.size() != drawBuffer.size())
+    {
+      return false;
+    }
+    std::copy(back_.begin(), back_.end(), drawBuffer.begin());
+    return true;
+  }
+
+  // Time the last collected job took to render
+  uint32_t renderUs() const
+  {
+    return renderUs_;
+  }
+
+  // Renderer loop. On the pico this is core 1's entry point and never returns;
+  // on the host it returns once stop() is called.
+  void runRenderer()
+  {
+    uint32_t seen = finished_.load(std::memory_order_relaxed);
+    while (!stop_.load(std::memory_order_relaxed))
+    {
+      uint32_t posted = posted_.load(std::memory_order_acquire);
+      if (posted == seen)
+      {
+        tight_loop_contents();
+        continue;
+      }
+      uint32_t startUs = time_us_32();
+      if (back_.size() != job_.size)
+      {
+        back_.resize(job_.size);
+      }
+      // Scene switches happen here too, so scenes are built on this core
+      if (job_.invalidate)
+      {
+        SceneCompositor.invalidate();
+      }
+      AudioScene::Input = job_.audio;
+      changed_ = SceneCompositor.render(back_, job_.composition, job_.deltaTime, job_.param);
+      renderUs_ = time_us_32() - startUs;
+      seen = posted;
+      finished_.store(posted, std::memory_order_release);
+    }
+  }
+
+  void stop()
+  {
+    stop_.store(true, std::memory_order_relaxed);
+  }
+
+private:
+  Job job_;
+  LEDBuffer back_;
+  bool pending_ = false;
+  bool changed_ = false;
+  uint32_t renderUs_ = 0;
+  std::atomic<uint32_t> posted_ {0};
+  std::atomic<uint32_t> finished_ {0};
+  std::atomic<bool> stop_ {false};
+};
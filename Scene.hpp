@@ -2,58 +2,244 @@
 
 #include <cpp/Color.hpp>
 #include <cpp/LedStripWs2812b.hpp>
-#include <map>
+#include "Animation.hpp"
+#include "AudioAnalyzer.hpp"
+#include "Blend.hpp"
+#include "HueTable.hpp"
+#include "Particles.hpp"
+#include "Pattern.hpp"
+#include "PixelMap.hpp"
+#include "Random.hpp"
+#include <algorithm>
 #include <cmath>
-#include <cstdlib>
-#include <memory>
-
-static inline float rand_f(float min, float max)
-{
-  return min + static_cast<float>(rand()) / ( static_cast<float>(RAND_MAX)/(max-min));
-}
+#include <new>
 
 class Scene
 {
 public:
   virtual ~Scene() = default;
-  virtual void update(LEDBuffer& buffer, float deltaTime, float param) = 0;
+
+  // Draw the next frame into buffer. Returns false if the buffer was left
+  // alone because the frame would be the same as the last one.
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) = 0;
+
+  // Something else drew into the buffer since the last update, so the next
+  // one has to redraw even if nothing changed
+  void invalidate()
+  {
+    drawnSize_ = -1;
+  }
+
+  // Set the LED layout, null for a plain line. Only call while the scene
+  // isn't rendering; the map must outlive the scene or the next layout() call.
+  void layout(const PixelMap* map)
+  {
+    map_ = map;
+    invalidate();
+    if (map) layoutChanged(*map);
+  }
+
 protected:
   Scene() = default;
+
+  // For scenes that precompute anything from the layout
+  virtual void layoutChanged(const PixelMap& /* map */) {}
+
+  // The layout if it's 2D and describes this buffer, otherwise null and the
+  // scene should draw a plain line
+  const PixelMap* spatial(const LEDBuffer& buffer) const
+  {
+    if (map_ && !map_->isLine() && map_->size() == (int)buffer.size())
+    {
+      return map_;
+    }
+    return nullptr;
+  }
+
+  // For scenes whose output only depends on param and the buffer size
+  bool needsRedraw(const LEDBuffer& buffer, float param)
+  {
+    if ((int)buffer.size() == drawnSize_ && param == drawnParam_)
+    {
+      return false;
+    }
+    drawnSize_ = (int)buffer.size();
+    drawnParam_ = param;
+    return true;
+  }
+
+private:
+  const PixelMap* map_ = nullptr;
+  int drawnSize_ = -1;
+  float drawnParam_ = 0.0f;
 };
 
-using SceneCollection = std::vector<std::unique_ptr<Scene>>;
-SceneCollection Scenes;
-std::vector<std::string> SceneNames;
-template <typename T>
-struct SceneTypeRegistration
+// The scenes, fixed at compile time. Only the active one exists: activate()
+// destroys it and constructs the next in place in an arena sized for the
+// largest scene, so switching doesn't touch the heap (beyond what the scene
+// itself allocates) and memory a scene allocated goes back when it's left.
+// The table itself has no constructor code, so nothing runs at boot.
+//
+// Each scene type provides a `static constexpr const char* Name`.
+template <typename... Ts>
+class SceneTable
 {
-  SceneTypeRegistration<T>(std::string name) 
+public:
+  static constexpr int size() { return (int)sizeof...(Ts); }
+  static constexpr const char* name(int index) { return Names[index]; }
+
+  // Bytes reserved for the active scene
+  static constexpr size_t ArenaSize = std::max({sizeof(Ts)...});
+  // Bytes every scene would take constructed at once
+  static constexpr size_t TotalSize = (sizeof(Ts) + ...);
+
+  constexpr SceneTable() = default;
+
+  ~SceneTable()
+  {
+    deactivate();
+  }
+
+  // Make a scene the active one, constructing it if it isn't already.
+  // Whichever core renders should be the only one calling this.
+  Scene& activate(int index)
   {
-    SceneNames.push_back(name);
-    Scenes.push_back(std::make_unique<T>());
+    if (index != activeIndex_)
+    {
+      deactivate();
+      active_ = Factories[index](arena_);
+      activeIndex_ = index;
+      active_->layout(layout_);
+    }
+    return *active_;
   }
+
+  // Destroy the active scene, if any
+  void deactivate()
+  {
+    if (active_)
+    {
+      active_->~Scene();
+      active_ = nullptr;
+      activeIndex_ = -1;
+    }
+  }
+
+  Scene* active() { return active_; }
+  int activeIndex() const { return activeIndex_; }
+
+  // Layout for the active scene and every one activated after it
+  void layout(const PixelMap* map)
+  {
+    layout_ = map;
+    if (active_) active_->layout(map);
+  }
+
+private:
+  template <typename T>
+  static Scene* construct(void* arena)
+  {
+    return new (arena) T();
+  }
+
+  static constexpr const char* Names[] = {Ts::Name...};
+  static constexpr Scene* (*Factories[])(void*) = {&construct<Ts>...};
+
+  alignas(Ts...) unsigned char arena_[ArenaSize] = {};
+  Scene* active_ = nullptr;
+  int activeIndex_ = -1;
+  const PixelMap* layout_ = nullptr;
 };
-#define RegisterScene(T) static SceneTypeRegistration<T> _registration##T(#T)
 
-class WarmWhite : public Scene
+// Base for scenes that draw one pattern, repeating along the buffer, chosen
+// by a key the scene derives from param. The first period comes from Cache
+// or is drawn once, and the rest of the buffer is block copies of it; on a 2D
+// layout the pattern runs along the diagonals. The buffer is only redrawn
+// when the key or size changes or after an invalidate, so moving param
+// within one key's range costs nothing.
+class PatternScene : public Scene
 {
 public:
-  virtual void update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  static inline PatternCache Cache;
+
+protected:
+  // Draw the pattern for key, period LEDs long. draw(colors) fills in a
+  // period when it isn't cached. scene identifies the scene in the cache.
+  template <typename Draw>
+  bool drawPattern(LEDBuffer& buffer, const char* scene, uint32_t key, int period, Draw draw)
   {
-    float colorTempK = (param*7000.0f) + 2000.0f;
-    auto color = GetColorFromTemperature(colorTempK);
-    for (int i = 0; i < buffer.size(); ++i)
+    bool stale = needsRedraw(buffer, 0.0f);
+    if ((!stale && key == drawnKey_) || buffer.empty() || period <= 0)
     {
-      buffer[i] = color;
+      return false;
+    }
+    drawnKey_ = key;
+
+    const RGBColor* colors = Cache.find(scene, key);
+    if (!colors)
+    {
+      RGBColor* stored = Cache.store(scene, key, period);
+      if (!stored)
+      {
+        scratch_.resize(period);
+        stored = scratch_.data();
+      }
+      draw(stored);
+      colors = stored;
+    }
+
+    // A single color is the same on any layout
+    const PixelMap* map = period > 1 ? spatial(buffer) : nullptr;
+    LEDBuffer& line = map ? diagonal_ : buffer;
+    if (map)
+    {
+      diagonal_.resize(map->width() + map->height() - 1);
+    }
+    const size_t count = std::min((size_t)period, line.size());
+    std::copy(colors, colors + count, line.begin());
+    repeatPeriod(line, period);
+    if (map)
+    {
+      const uint16_t* x = map->x();
+      const uint16_t* y = map->y();
+      for (int i = 0; i < (int)buffer.size(); ++i)
+      {
+        buffer[i] = diagonal_[x[i] + y[i]];
+      }
     }
+    return true;
+  }
+
+private:
+  uint32_t drawnKey_ = 0;
+  // The pattern along the diagonals of a 2D layout
+  LEDBuffer diagonal_;
+  // A period too long for the cache
+  LEDBuffer scratch_;
+};
+
+class WarmWhite : public PatternScene
+{
+public:
+  static constexpr const char* Name = "WarmWhite";
+
+  virtual bool update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  {
+    // Whole kelvin, so the color only has to be worked out once for each
+    int colorTempK = (int)std::lround(param * 7000.0f) + 2000;
+    return drawPattern(buffer, Name, (uint32_t)colorTempK, 1, [&](RGBColor* colors)
+    {
+      colors[0] = GetColorFromTemperature((float)colorTempK);
+    });
   }
 };
-RegisterScene(WarmWhite);
 
 class GamerRGB : public Scene
 {
 public:
-  virtual void update(LEDBuffer& buffer, float deltaTime, float param) override
+  static constexpr const char* Name = "GamerRGB";
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) override
   {
     float tMax = param * 19.0f + 1.0f;
     t = fmodf(t + deltaTime, tMax);
@@ -61,113 +247,407 @@ public:
     {
       t = 0;
     }
-    float baseHue = t * (360.0f / tMax);
+    if (buffer.empty())
+    {
+      return false;
+    }
+    // One full turn of hue is spread across the buffer, or across the width
+    // of a 2D layout so each column is one color
+    uint32_t baseHue = (uint32_t)hueFromUnit(t / tMax) << 16;
+    const PixelMap* map = spatial(buffer);
+    if (!map)
+    {
+      fillHueRamp(buffer, baseHue, (uint32_t)(0x100000000ull / buffer.size()));
+      return true;
+    }
+    column_.resize(map->width());
+    fillHueRamp(column_, baseHue, (uint32_t)(0x100000000ull / column_.size()));
+    const uint16_t* x = map->x();
     for (int i = 0; i < buffer.size(); ++i)
     {
-      float locationOffsetHue = (float)i * (360.0f / (float)buffer.size());
-      buffer[i] = HSVColor{ fmodf(baseHue + locationOffsetHue, 360.0f) , 1.0f, 1.0f }.toRGB();
+      buffer[i] = column_[x[i]];
     }
+    return true;
   }
 private:
   float t = 0.0f;
+  LEDBuffer column_;
 };
-RegisterScene(GamerRGB);
 
 class Halloween : public Scene
 {
 public:
-  Halloween()
+  static constexpr const char* Name = "Halloween";
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float /* param */) override
   {
-    srand(349875232);
-    t_ = fadeTime;
+    if (src_.size() != buffer.size())
+    {
+      // Fade in from black
+      src_.assign(buffer.size(), RGBColor{0, 0, 0});
+      dst_.resize(buffer.size());
+      for (RGBColor& color : dst_)
+      {
+        color = randomColor();
+      }
+    }
+
+    // Every LED fades on its own cycle, offset from its neighbours by the
+    // golden ratio, so each frame only the few LEDs whose cycle rolled over
+    // need a new color rather than all of them every FadeTime. Phases are
+    // 32-bit fractions of a cycle.
+    uint32_t step = (uint32_t)(std::min(deltaTime / FadeTime, 1.0f) * 4294967295.0f);
+    phase_ += step;
+    for (int i=0; i < buffer.size(); ++i)
+    {
+      uint32_t phase = phase_ + (uint32_t)i * PhaseSpread;
+      if (phase < step)
+      {
+        src_[i] = dst_[i];
+        dst_[i] = randomColor();
+      }
+      buffer[i] = blendColor(src_[i], dst_[i], phase >> 24);
+    }
+    return true;
   }
-  ~Halloween() = default;
 
-  virtual void update(LEDBuffer& buffer, float deltaTime, float param) override
+private:
+  static constexpr float FadeTime = 4.0f;
+  static constexpr uint32_t PhaseSpread = 0x9E3779B9;
+  // 10 to 20 degrees
+  static constexpr int MinHue = 0x10000 * 10 / 360;
+  static constexpr int MaxHue = 0x10000 * 20 / 360;
+
+  // Orange, nearly fully saturated, 30-70% value
+  RGBColor randomColor()
   {
-    // Make sure these guys are the right size!
-    src_.resize(buffer.size());
-    dst_.resize(buffer.size());
+    uint16_t hue = (uint16_t)random_.range(MinHue, MaxHue);
+    uint8_t saturation = (uint8_t)random_.range(230, 255);
+    uint8_t value = (uint8_t)random_.range(77, 178);
+    return hsvToRGB(hue, saturation, value);
+  }
+
+  Random random_ {349875232};
+  uint32_t phase_ = 0;
+  std::vector<RGBColor> src_;
+  std::vector<RGBColor> dst_;
+};
 
-    t_ += deltaTime;
-    if (t_ >= fadeTime)
+class PureColor : public PatternScene
+{
+public:
+  static constexpr const char* Name = "PureColor";
+
+  virtual bool update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  {
+    uint16_t hue = hueFromUnit(param);
+    return drawPattern(buffer, Name, hue, 1, [&](RGBColor* colors)
     {
-      dst_.swap(src_);
-      generateColors(dst_);
+      colors[0] = hueToRGB(hue);
+    });
+  }
+};
+
+class CandyCane : public PatternScene
+{
+public:
+  static constexpr const char* Name = "CandyCane";
+
+  virtual bool update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  {
+    int spacing = std::round(param * 20.0f) + 1.0f;
+    spacing += 1;
+    // Stripes run diagonally on a 2D layout
+    return drawPattern(buffer, Name, (uint32_t)spacing, spacing * 2, [&](RGBColor* colors)
+    {
+      std::fill(colors, colors + spacing, RGBColor{230, 30, 0});
+      std::fill(colors + spacing, colors + spacing * 2, RGBColor{86, 86, 86});
+    });
+  }
+};
+
+class ChristmasStripes : public PatternScene
+{
+public:
+  static constexpr const char* Name = "ChristmasStripes";
+
+  virtual bool update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  {
+    int spacing = std::round(param * 20.0f) + 1.0f;
+    spacing += 1;
+    // Stripes run diagonally on a 2D layout
+    return drawPattern(buffer, Name, (uint32_t)spacing, spacing * 2, [&](RGBColor* colors)
+    {
+      std::fill(colors, colors + spacing, RGBColor{230, 30, 0});
+      std::fill(colors + spacing, colors + spacing * 2, RGBColor{0, 230, 30});
+    });
+  }
+};
+
+// Plays the animation image in flash (see Animation.hpp), decoding each frame
+// straight from flash into the buffer. Deltas are applied in order, so after
+// a seek, a loop or an invalidate it decodes forward from the nearest
+// keyframe. Runs at the image's frame rate, up to 4x faster as param goes to
+// 1. Black if there's no image.
+class FlashAnimation : public Scene
+{
+public:
+  static constexpr const char* Name = "FlashAnimation";
+
+  // Where the image lives (XIP flash on the device) and the most it can span.
+  // Read when the scene is activated.
+  static inline const uint8_t* Source = nullptr;
+  static inline uint32_t SourceSize = 0;
+
+  FlashAnimation() : image_(Source, SourceSize) {}
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) override
+  {
+    // Also true when the buffer was drawn over, and the deltas no longer apply
+    bool redraw = needsRedraw(buffer, param);
+    if (redraw)
+    {
+      std::fill(buffer.begin(), buffer.end(), RGBColor{0, 0, 0});
     }
-    while (t_ >= fadeTime)
+    if (!image_.valid())
     {
-      t_ -= fadeTime;
+      return redraw;
     }
-    float tParam = t_ / fadeTime;
-    for (int i=0; i < buffer.size(); ++i)
+
+    float duration = (float)image_.frames() / image_.fps();
+    time_ += deltaTime * (1.0f + param * 3.0f);
+    if (time_ >= duration)
+    {
+      time_ = std::fmod(time_, duration);
+    }
+    uint32_t target = std::min((uint32_t)(time_ * image_.fps()), image_.frames() - 1);
+    if (!redraw && target == frame_)
     {
-      buffer[i] = RGBColor::blend(src_[i], dst_[i], tParam);
+      return false;
     }
+
+    uint32_t first = image_.keyframeBefore(target);
+    if (!redraw && frame_ < target && frame_ >= first)
+    {
+      first = frame_ + 1;
+    }
+    for (uint32_t f = first; f <= target; ++f)
+    {
+      if (!image_.decode(f, buffer.data(), (uint32_t)buffer.size()))
+      {
+        image_ = AnimationImage();
+        std::fill(buffer.begin(), buffer.end(), RGBColor{0, 0, 0});
+        break;
+      }
+    }
+    frame_ = target;
+    return true;
   }
 
-  void generateColors(std::vector<RGBColor>& arr)
+private:
+  AnimationImage image_;
+  float time_ = 0.0f;
+  uint32_t frame_ = 0;
+};
+
+// Base for the scenes that follow the audio input. Input is the latest
+// analysis, handed over by whichever core renders just before each render
+// (see RenderPipeline::Job); all zero while the audio input is off.
+class AudioScene : public Scene
+{
+public:
+  static inline AudioFeatures Input;
+};
+
+// The bands side by side, bass first, each lit as bright as it is loud with
+// a short fall-off. On a 2D layout the bands are columns of bars. param
+// turns the band colors around the hue circle.
+class AudioSpectrum : public AudioScene
+{
+public:
+  static constexpr const char* Name = "AudioSpectrum";
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) override
   {
-    for (int i=0; i < arr.size(); ++i)
+    if (buffer.empty())
+    {
+      return false;
+    }
+    // Up at once, down over FallTime
+    uint8_t values[Bands];
+    RGBColor colors[Bands];
+    for (int b = 0; b < Bands; ++b)
+    {
+      levels_[b] = std::max(Input.bands[b], levels_[b] - deltaTime / FallTime);
+      values[b] = (uint8_t)(std::min(std::max(levels_[b], 0.0f), 1.0f) * 255.0f);
+      // Red for bass through to violet for treble
+      colors[b] = hsvToRGB(hueFromUnit(param + b * (0.75f / Bands)), 255, values[b]);
+    }
+
+    const PixelMap* map = spatial(buffer);
+    if (!map)
+    {
+      for (int i = 0; i < (int)buffer.size(); ++i)
+      {
+        buffer[i] = colors[i * Bands / (int)buffer.size()];
+      }
+      return true;
+    }
+    // Bars grow up from the bottom row
+    const uint16_t* x = map->x();
+    const uint16_t* y = map->y();
+    const int width = map->width();
+    const int height = map->height();
+    for (int i = 0; i < (int)buffer.size(); ++i)
     {
-      float hue = rand_f(10.0, 20.0);
-      float saturation = rand_f(0.9f, 1.0f);
-      float brightness = rand_f(0.3f, 0.7f);
-      arr[i] = HSVColor{hue, saturation, brightness}.toRGB();
+      int b = x[i] * Bands / width;
+      int lit = (values[b] * height + 254) / 255;
+      buffer[i] = height - y[i] <= lit ? colors[b] : RGBColor{0, 0, 0};
     }
+    return true;
   }
 
 private:
-  float t_ = 0;
-  std::vector<RGBColor> src_;
-  std::vector<RGBColor> dst_;
-  float fadeTime = 4.0f;
+  static constexpr int Bands = AudioFeatures::Bands;
+  static constexpr float FallTime = 0.3f;
+
+  float levels_[Bands] = {};
 };
-RegisterScene(Halloween);
 
-class PureColor : public Scene
+// Flashes the whole display on every beat, a new color each time, fading out
+// until the next one, over a glow that follows the overall level. param sets
+// how long a flash lasts, 0.1 to 1 second.
+class AudioPulse : public AudioScene
 {
 public:
-  virtual void update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  static constexpr const char* Name = "AudioPulse";
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) override
   {
-    float hue = param * 360.0f;
-    auto color = HSVColor{hue, 1.0f, 1.0f}.toRGB();
-    for (int i = 0; i < buffer.size(); ++i)
+    if (Input.beats != beats_)
+    {
+      beats_ = Input.beats;
+      pulse_ = 1.0f;
+      // Golden ratio steps, so consecutive colors are far apart
+      hue_ += 0x9E37;
+    }
+    else
+    {
+      pulse_ = std::max(0.0f, pulse_ - deltaTime / (0.1f + param * 0.9f));
+    }
+    float glow = Input.level * 0.25f;
+    uint8_t value = (uint8_t)(std::min(std::max(pulse_ * pulse_ + glow, 0.0f), 1.0f) * 255.0f);
+    RGBColor color = hsvToRGB(hue_, 255, value);
+    for (int i = 0; i < (int)buffer.size(); ++i)
     {
       buffer[i] = color;
     }
+    return !buffer.empty();
   }
+
+private:
+  uint32_t beats_ = 0;
+  float pulse_ = 0.0f;
+  uint16_t hue_ = 0;
 };
-RegisterScene(PureColor);
 
-class CandyCane : public Scene
+// Base for scenes made of particles on black. Once the buffer holds the last
+// frame, an update only erases and redraws the LEDs the particles cover (see
+// ParticlePool), so a long strip with a few dozen particles costs about the
+// same as a short one. A new buffer size or an invalidate clears the whole
+// buffer once. Particles run along the buffer, so on a 2D layout they follow
+// the wiring.
+template <int Capacity>
+class ParticleScene : public Scene
 {
 public:
-  virtual void update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  // Particles alive, for the benchmarks
+  int particles() const { return particles_.size(); }
+
+protected:
+  bool drawParticles(LEDBuffer& buffer, float deltaTime)
   {
-    int spacing = std::round(param * 20.0f) + 1.0f;
-    spacing += 1;
-    RGBColor colors[2] = {{230, 30, 0}, {86, 86, 86}};
-    for (int i = 0; i < buffer.size(); ++i)
+    if (needsRedraw(buffer, 0.0f))
     {
-      buffer[i] = colors[(i/spacing)%2];
+      std::fill(buffer.begin(), buffer.end(), RGBColor{0, 0, 0});
+      particles_.step(buffer, deltaTime);
+      return !buffer.empty();
     }
+    return particles_.step(buffer, deltaTime);
   }
+
+  ParticlePool<Capacity> particles_;
 };
-RegisterScene(CandyCane);
 
-class ChristmasStripes : public Scene
+// Twinkles at random LEDs, pale colors flashing up and fading out over about
+// a second. param sets how many start each second, up to MaxRate.
+class Sparkles : public ParticleScene<64>
 {
 public:
-  virtual void update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  static constexpr const char* Name = "Sparkles";
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) override
   {
-    int spacing = std::round(param * 20.0f) + 1.0f;
-    spacing += 1;
-    RGBColor colors[2] = {{230, 30, 0}, {0, 230, 30}};
-    for (int i = 0; i < buffer.size(); ++i)
+    due_ += param * MaxRate * deltaTime;
+    for (; due_ >= 1.0f && !buffer.empty(); due_ -= 1.0f)
     {
-      buffer[i] = colors[(i/spacing)%2];
+      Particle* p = particles_.spawn();
+      if (!p)
+      {
+        due_ = 0.0f;
+        break;
+      }
+      p->position = (float)random_.range(0, (int)buffer.size() - 1);
+      p->decay = 1000.0f / random_.range(500, 1500);
+      p->color = hsvToRGB((uint16_t)random_.range(0, 0xFFFF), (uint8_t)random_.range(0, 96), 255);
     }
+    return drawParticles(buffer, deltaTime);
   }
+
+private:
+  static constexpr float MaxRate = 100.0f;
+
+  Random random_ {2038074743};
+  float due_ = 0.0f;
 };
-RegisterScene(ChristmasStripes);
\ No newline at end of file
+
+// Comets streaking both ways along the buffer, a few new ones a second, each
+// a random color with a fading tail. param sets how fast new ones go, 20 to
+// 200 LEDs a second.
+class Comets : public ParticleScene<16>
+{
+public:
+  static constexpr const char* Name = "Comets";
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float param) override
+  {
+    due_ += SpawnRate * deltaTime;
+    for (; due_ >= 1.0f && !buffer.empty(); due_ -= 1.0f)
+    {
+      Particle* p = particles_.spawn();
+      if (!p)
+      {
+        due_ = 0.0f;
+        break;
+      }
+      float speed = (20.0f + param * 180.0f) * random_.range(75, 125) * 0.01f;
+      p->position = (float)random_.range(0, (int)buffer.size() - 1);
+      p->velocity = random_.range(0, 1) ? speed : -speed;
+      p->decay = 1000.0f / random_.range(2000, 4000);
+      p->tail = (uint8_t)random_.range(6, 24);
+      p->color = hueToRGB((uint16_t)random_.range(0, 0xFFFF));
+    }
+    return drawParticles(buffer, deltaTime);
+  }
+
+private:
+  static constexpr float SpawnRate = 3.0f;
+
+  Random random_ {1645382491};
+  float due_ = 0.0f;
+};
+
+// Every scene, in the order the scene command and buttons cycle through them.
+// The Compositor holds the tables the firmware renders from.
+using SceneList = SceneTable<WarmWhite, GamerRGB, Halloween, PureColor, CandyCane, ChristmasStripes, FlashAnimation,
+                            AudioSpectrum, AudioPulse, Sparkles, Comets>;
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <pico/stdio.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <streambuf>
+
+// Ring buffer behind std::cout.
+//
+// Everything printed lands in RAM and std::endl no longer pushes a line out
+// to USB on its own; the main loop calls pump() once per frame, which sends at
+// most a budget's worth. Command responses go out together, and printing can't
+// stall a frame on the USB link. Only if the ring fills does printing wait and
+// send the oldest bytes right away, so nothing is lost.
+class SerialTx : public std::streambuf
+{
+public:
+  static constexpr size_t Capacity = 8192;
+
+  // Where bytes end up, stdio on the device
+  using Writer = void (*)(const char* data, int len);
+
+  SerialTx(Writer writer = stdioWrite) : writer_(writer) {}
+
+  ~SerialTx()
+  {
+    uninstall();
+  }
+
+  // Route std::cout through the ring
+  void install()
+  {
+    if (!previous_) previous_ = std::cout.rdbuf(this);
+  }
+
+  void uninstall()
+  {
+    if (previous_)
+    {
+      flush();
+      std::cout.rdbuf(previous_);
+      previous_ = nullptr;
+    }
+  }
+
+  size_t used() const { return size_; }
+  size_t space() const { return Capacity - size_; }
+
+  // Times printing had to wait for a full ring
+  uint32_t stalls() const { return stalls_; }
+
+  // Send up to budget queued bytes. Returns how many went out.
+  size_t pump(size_t budget)
+  {
+    size_t sent = 0;
+    while (size_ > 0 && sent < budget)
+    {
+      // The queued bytes from head_ to the end of the array, or less
+      size_t chunk = std::min({size_, Capacity - head_, budget - sent});
+      writer_(ring_ + head_, (int)chunk);
+      head_ = (head_ + chunk) % Capacity;
+      size_ -= chunk;
+      sent += chunk;
+    }
+    return sent;
+  }
+
+  // Send everything now, e.g. before a reboot
+  void flush()
+  {
+    pump(size_);
+  }
+
+protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override
+  {
+    std::streamsize left = n;
+    while (left > 0)
+    {
+      if (size_ == Capacity)
+      {
+        ++stalls_;
+        pump(Capacity / 4);
+      }
+      size_t tail = (head_ + size_) % Capacity;
+      size_t chunk = std::min({(size_t)left, Capacity - size_, Capacity - tail});
+      std::copy(s, s + chunk, ring_ + tail);
+      size_ += chunk;
+      s += chunk;
+      left -= (std::streamsize)chunk;
+    }
+    return n;
+  }
+
+  int_type overflow(int_type ch) override
+  {
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+      char c = traits_type::to_char_type(ch);
+      xsputn(&c, 1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  // Lines are batched: pump() sends them
+  int sync() override
+  {
+    return 0;
+  }
+
+private:
+  static void stdioWrite(const char* data, int len)
+  {
+    stdio_put_string(data, len, false, true);
+  }
+
+  Writer writer_;
+  std::streambuf* previous_ = nullptr;
+  char ring_[Capacity];
+  size_t head_ = 0;
+  size_t size_ = 0;
+  uint32_t stalls_ = 0;
+};
+
+// Prints the draw buffer a few lines per frame, so a dump of 10000 LEDs
+// doesn't stop the show while it goes out. Values are read as each line is
+// printed; halt first for a consistent snapshot.
+//
+// Text lines are `idx <i> (<r> , <g> , <b> )`. Hex lines are `hex <first-led>`
+// followed by rrggbb for up to HexLedsPerLine LEDs, about a quarter the bytes.
+class BufferDump
+{
+public:
+  static constexpr int HexLedsPerLine = 32;
+
+  void start(bool hex)
+  {
+    hex_ = hex;
+    next_ = 0;
+  }
+
+  bool active() const { return next_ >= 0; }
+
+  // Print lines while they fit in maxBytes. Prints the header with the first
+  // chunk and the trailer once the buffer is done.
+  void pump(const LEDBuffer& buffer, std::ostream& out, size_t maxBytes)
+  {
+    if (next_ < 0) return;
+    size_t written = 0;
+    if (next_ == 0)
+    {
+      out << "Dumping display buffer..." << "\n";
+      written += 26;
+    }
+    const size_t lineMax = hex_ ? 16 + HexLedsPerLine * 6 : 30;
+    char line[16 + HexLedsPerLine * 6 + 2];
+    while (next_ < (int)buffer.size() && written + lineMax <= maxBytes)
+    {
+      int len = hex_ ? hexLine(buffer, line) : textLine(buffer, line);
+      out.write(line, len);
+      written += len;
+    }
+    if (next_ >= (int)buffer.size() && written + 22 <= maxBytes)
+    {
+      out << "End of display buffer" << "\n";
+      next_ = -1;
+    }
+  }
+
+private:
+  int textLine(const LEDBuffer& buffer, char* line)
+  {
+    const RGBColor& c = buffer[next_];
+    int len = snprintf(line, 32, "idx %d (%d , %d , %d )\n", next_, c.R, c.G, c.B);
+    ++next_;
+    return len;
+  }
+
+  int hexLine(const LEDBuffer& buffer, char* line)
+  {
+    static const char digits[] = "0123456789abcdef";
+    int len = snprintf(line, 16, "hex %d ", next_);
+    int end = std::min(next_ + HexLedsPerLine, (int)buffer.size());
+    for (; next_ < end; ++next_)
+    {
+      const RGBColor& c = buffer[next_];
+      for (uint8_t v : {c.R, c.G, c.B})
+      {
+        line[len++] = digits[v >> 4];
+        line[len++] = digits[v & 15];
+      }
+    }
+    line[len++] = '\n';
+    return len;
+  }
+
+  int next_ = -1;
+  bool hex_ = false;
+};
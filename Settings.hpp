@@ -2,7 +2,9 @@
 
 #include <cpp/Color.hpp>
 #include <cpp/LedStripWs2812b.hpp>
-#include "Scene.hpp"
+#include "Compositor.hpp"
+#include "LedOutput.hpp"
+#include "PixelMap.hpp"
 
 #include "hardware/flash.h"
 #include <pico/stdlib.h>
@@ -16,10 +18,12 @@
 
 #define MAX_BUFFER_LENGTH 10000
 
+// Bounds are non-deduced so literals like 0ul work whatever uint32_t is on the target.
+// Written so a NaN fails too.
 template <typename T>
-bool validate(T& field, T min, T max, T defaultVal)
+bool validate(T& field, typename std::common_type<T>::type min, typename std::common_type<T>::type max, typename std::common_type<T>::type defaultVal)
 {
-  if (field < min || field > max)
+  if (!(field >= min && field <= max))
   {
     field = defaultVal;
     return true;
@@ -27,9 +31,26 @@ bool validate(T& field, T min, T max, T defaultVal)
   return false;
 }
 
-struct Settings
+// Number of chains a board can drive: one per PIO state machine
+constexpr int MaxChains = 8;
+
+// Default data pins. The first four match the original hard-wired chains.
+constexpr uint DefaultChainPins[MaxChains] = {22, 26, 27, 28, 6, 7, 8, 9};
+
+struct ChainSettings
+{
+  uint32_t pin;
+  uint32_t count;
+  int offset;
+  Vec3f colorBalance;
+  float gamma;
+  int ditherBits;
+};
+
+// Flash layout of the original firmware, before the chain table, kept so
+// settings it saved can be migrated. Exactly what it wrote: don't change it.
+struct SettingsV1
 {
-public:
   bool autosave;
   int scene;
   float brightness;
@@ -50,30 +71,138 @@ public:
   float chain1Gamma;
   float chain2Gamma;
   float chain3Gamma;
+};
+
+// Bump when the layout below changes. New fields go at the end and get their
+// defaults in upgrade(). The V1 layout starts with a bool, so its first word
+// never reads as a valid version.
+constexpr uint32_t SettingsVersion = 6;
+
+struct Settings
+{
+public:
+  uint32_t version;
+  bool autosave;
+  int scene;
+  float brightness;
+  float param;
+  float targetFps;
+  bool pipelined;
+  ChainSettings chains[MaxChains];
+  // Version 3
+  uint32_t layoutWidth;   // 0 for a plain line
+  uint32_t layoutHeight;
+  bool serpentine;
+  bool chainReversed[MaxChains];
+  // Version 4
+  float fadeTime;
+  int overlay;            // -1 for none
+  BlendMode overlayMode;
+  float overlayOpacity;
+  // Version 5
+  float channelMilliamps;  // one channel at full output
+  float idleMilliamps;     // one dark LED
+  float powerBudget[MaxChains];  // mA, 0 for no limit
+  // Version 6
+  int audioInput;          // ADC input 0-2 (GPIO 26-28), -1 for off
 
   // Set all settings to their default values
   void setDefaults()
   {
+    version = SettingsVersion;
     autosave = false;
     scene = 0;
     brightness = 1.0f;
     param = 0.0f;
-    chain0Count = 1ul;
-    chain1Count = 0ul;
-    chain2Count = 0ul;
-    chain3Count = 0ul;
-    chain0Offset = 0;
-    chain1Offset = 0;
-    chain2Offset = 0;
-    chain3Offset = 0;
-    chain0ColorBalance = {1.0f, 1.0f, 1.0f};
-    chain1ColorBalance = {1.0f, 1.0f, 1.0f};
-    chain2ColorBalance = {1.0f, 1.0f, 1.0f};
-    chain3ColorBalance = {1.0f, 1.0f, 1.0f};
-    chain0Gamma = 1.0f;
-    chain1Gamma = 1.0f;
-    chain2Gamma = 1.0f;
-    chain3Gamma = 1.0f;
+    targetFps = 20.0f;
+    pipelined = false;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      chains[i] = {DefaultChainPins[i], i == 0 ? 1u : 0u, 0, {1.0f, 1.0f, 1.0f}, 1.0f, 0};
+    }
+    setLayoutDefaults();
+    setLayerDefaults();
+    setPowerDefaults();
+    setAudioDefaults();
+  }
+
+  // True if these are settings this firmware can upgrade() and use
+  bool versionSupported() const
+  {
+    return version >= 2 && version <= SettingsVersion;
+  }
+
+  // Give the fields added since the saved version their defaults
+  void upgrade()
+  {
+    if (version < 3)
+    {
+      setLayoutDefaults();
+    }
+    if (version < 4)
+    {
+      setLayerDefaults();
+    }
+    if (version < 5)
+    {
+      setPowerDefaults();
+    }
+    if (version < 6)
+    {
+      setAudioDefaults();
+    }
+    version = SettingsVersion;
+  }
+
+  void setLayoutDefaults()
+  {
+    layoutWidth = 0;
+    layoutHeight = 0;
+    serpentine = false;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      chainReversed[i] = false;
+    }
+  }
+
+  void setLayerDefaults()
+  {
+    fadeTime = 0.0f;
+    overlay = Composition::NoScene;
+    overlayMode = BlendMode::Alpha;
+    overlayOpacity = 1.0f;
+  }
+
+  // WS2812B figures; no limit until a budget is set
+  void setPowerDefaults()
+  {
+    channelMilliamps = 20.0f;
+    idleMilliamps = 1.0f;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      powerBudget[i] = 0.0f;
+    }
+  }
+
+  // Off: the ADC pins are also LED strip pins
+  void setAudioDefaults()
+  {
+    audioInput = -1;
+  }
+
+  // Take over settings saved by older firmware
+  void migrate(const SettingsV1& old)
+  {
+    setDefaults();
+    autosave = old.autosave;
+    scene = old.scene;
+    brightness = old.brightness;
+    param = old.param;
+    // Frame rate, pipelining and dithering came later and keep their defaults
+    chains[0] = {DefaultChainPins[0], old.chain0Count, old.chain0Offset, old.chain0ColorBalance, old.chain0Gamma, 0};
+    chains[1] = {DefaultChainPins[1], old.chain1Count, old.chain1Offset, old.chain1ColorBalance, old.chain1Gamma, 0};
+    chains[2] = {DefaultChainPins[2], old.chain2Count, old.chain2Offset, old.chain2ColorBalance, old.chain2Gamma, 0};
+    chains[3] = {DefaultChainPins[3], old.chain3Count, old.chain3Offset, old.chain3ColorBalance, old.chain3Gamma, 0};
   }
 
   // Returns true if all settings are ok, false if any had to be changed 
@@ -81,17 +210,28 @@ public:
   {
     // Validate some settings to stop the system from crashing by trying to allocate too much memory
     bool failedValidation = false;
-    failedValidation |= validate(scene, 0, (int)Scenes.size()-1, 0);
+    failedValidation |= validate(scene, 0, SceneList::size()-1, 0);
     failedValidation |= validate(brightness, 0.0f, 1.0f, 1.0f);
     failedValidation |= validate(param, 0.0f, 1.0f, 0.0f);
-    failedValidation |= validate(chain0Count, 0ul, (uint32_t)MAX_BUFFER_LENGTH, 1ul);
-    failedValidation |= validate(chain1Count, 0ul, (uint32_t)MAX_BUFFER_LENGTH, 0ul);
-    failedValidation |= validate(chain2Count, 0ul, (uint32_t)MAX_BUFFER_LENGTH, 0ul);
-    failedValidation |= validate(chain3Count, 0ul, (uint32_t)MAX_BUFFER_LENGTH, 0ul);
-    failedValidation |= validate(chain0Offset, 0, MAX_BUFFER_LENGTH-(int)chain0Count, 0);
-    failedValidation |= validate(chain1Offset, 0, MAX_BUFFER_LENGTH-(int)chain1Count, 0);
-    failedValidation |= validate(chain2Offset, 0, MAX_BUFFER_LENGTH-(int)chain2Count, 0);
-    failedValidation |= validate(chain3Offset, 0, MAX_BUFFER_LENGTH-(int)chain3Count, 0);
+    failedValidation |= validate(targetFps, 1.0f, 240.0f, 20.0f);
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      ChainSettings& chain = chains[i];
+      failedValidation |= validate(chain.pin, 0u, 29u, DefaultChainPins[i]);
+      failedValidation |= validate(chain.count, 0ul, (uint32_t)MAX_BUFFER_LENGTH, i == 0 ? 1u : 0u);
+      failedValidation |= validate(chain.offset, 0, MAX_BUFFER_LENGTH-(int)chain.count, 0);
+      failedValidation |= validate(chain.ditherBits, 0, 8, 0);
+      failedValidation |= validate(powerBudget[i], 0.0f, 1000000.0f, 0.0f);
+    }
+    failedValidation |= validate(layoutWidth, 0u, (uint32_t)PixelMap::MaxCells, 0u);
+    failedValidation |= validate(layoutHeight, 0u, (uint32_t)PixelMap::MaxCells / std::max<uint32_t>(layoutWidth, 1), 0u);
+    failedValidation |= validate(fadeTime, 0.0f, 60.0f, 0.0f);
+    failedValidation |= validate(overlay, Composition::NoScene, SceneList::size()-1, Composition::NoScene);
+    failedValidation |= validate(overlayMode, BlendMode::Alpha, BlendMode::Add, BlendMode::Alpha);
+    failedValidation |= validate(overlayOpacity, 0.0f, 1.0f, 1.0f);
+    failedValidation |= validate(channelMilliamps, 0.0f, 100.0f, 20.0f);
+    failedValidation |= validate(idleMilliamps, 0.0f, 10.0f, 1.0f);
+    failedValidation |= validate(audioInput, -1, 2, -1);
     return !failedValidation;
   }
 
@@ -103,69 +243,103 @@ public:
     std::cout << "    " << "scene:    " << scene << std::endl;
     std::cout << "    " << "brightness:    " << brightness << std::endl;
     std::cout << "    " << "param:    " << param << std::endl;
+    std::cout << "    " << "targetFps:    " << targetFps << std::endl;
+    std::cout << "    " << "pipelined:    " << pipelined << std::endl;
+    std::cout << "    " << "layout:    " << layoutWidth << " x " << layoutHeight << (serpentine ? " serpentine" : "") << std::endl;
+    std::cout << "    " << "fadeTime:    " << fadeTime << std::endl;
+    std::cout << "    " << "overlay:    " << overlay << (overlayMode == BlendMode::Add ? " add " : " alpha ") << overlayOpacity << std::endl;
+    std::cout << "    " << "powerModel:    " << channelMilliamps << " mA/channel, " << idleMilliamps << " mA/led idle" << std::endl;
+    std::cout << "    " << "audioInput:    " << audioInput << std::endl;
 
-    std::cout << "    " << "chain0Count:    " << chain0Count << std::endl;
-    std::cout << "    " << "chain0Offset:    " << chain0Offset << std::endl;
-    std::cout << "    " << "chain0ColorBalance:    " << "( " 
-                      << chain0ColorBalance.X << " , " 
-                      << chain0ColorBalance.Y << " , " 
-                      << chain0ColorBalance.Z << " )" << std::endl;
-    std::cout << "    " << "chain0Gamma:    " << chain0Gamma << std::endl;
-
-    std::cout << "    " << "chain1Count:    " << chain1Count << std::endl;
-    std::cout << "    " << "chain1Offset:    " << chain1Offset << std::endl;
-    std::cout << "    " << "chain1ColorBalance:    " << "( " 
-                      << chain1ColorBalance.X << " , " 
-                      << chain1ColorBalance.Y << " , " 
-                      << chain1ColorBalance.Z << " )" << std::endl;
-    std::cout << "    " << "chain1Gamma:    " << chain1Gamma << std::endl;
-
-    std::cout << "    " << "chain2Count:    " << chain2Count << std::endl;
-    std::cout << "    " << "chain2Offset:    " << chain2Offset << std::endl;
-    std::cout << "    " << "chain2ColorBalance:    " << "( " 
-                      << chain2ColorBalance.X << " , " 
-                      << chain2ColorBalance.Y << " , " 
-                      << chain2ColorBalance.Z << " )" << std::endl;
-    std::cout << "    " << "chain2Gamma:    " << chain2Gamma << std::endl;
-
-    std::cout << "    " << "chain3Count:    " << chain3Count << std::endl;
-    std::cout << "    " << "chain3Offset:    " << chain3Offset << std::endl;
-    std::cout << "    " << "chain3ColorBalance:    " << "( " 
-                      << chain3ColorBalance.X << " , " 
-                      << chain3ColorBalance.Y << " , " 
-                      << chain3ColorBalance.Z << " )" << std::endl;
-    std::cout << "    " << "chain3Gamma:    " << chain3Gamma << std::endl << std::flush;
-  }
-
-  void updateCalibrations(LedStripWs2812b& chain0, LedStripWs2812b& chain1, LedStripWs2812b& chain2, LedStripWs2812b& chain3)
-  {
-    chain0.colorBalance(chain0ColorBalance);
-    chain1.colorBalance(chain1ColorBalance);
-    chain2.colorBalance(chain2ColorBalance);
-    chain3.colorBalance(chain3ColorBalance);
-    chain0.gamma(chain0Gamma);
-    chain1.gamma(chain1Gamma);
-    chain2.gamma(chain2Gamma);
-    chain3.gamma(chain3Gamma);
-  }
-
-  void updateMappings(std::vector<LedStripWs2812b::BufferMapping>& mappings, LEDBuffer& drawBuffer)
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      const ChainSettings& chain = chains[i];
+      std::cout << "    " << "chain" << i << "Pin:    " << chain.pin << std::endl;
+      std::cout << "    " << "chain" << i << "Count:    " << chain.count << std::endl;
+      std::cout << "    " << "chain" << i << "Offset:    " << chain.offset << std::endl;
+      std::cout << "    " << "chain" << i << "ColorBalance:    " << "( " 
+                        << chain.colorBalance.X << " , " 
+                        << chain.colorBalance.Y << " , " 
+                        << chain.colorBalance.Z << " )" << std::endl;
+      std::cout << "    " << "chain" << i << "Gamma:    " << chain.gamma << std::endl;
+      std::cout << "    " << "chain" << i << "DitherBits:    " << chain.ditherBits << std::endl;
+      std::cout << "    " << "chain" << i << "Reversed:    " << chainReversed[i] << std::endl;
+      std::cout << "    " << "chain" << i << "PowerBudget:    " << powerBudget[i] << std::endl;
+    }
+    std::cout << std::flush;
+  }
+
+  // Pins for LedOutput; chains with no LEDs get none so they don't hold a
+  // state machine
+  std::vector<int> chainPins()
   {
-    // Refresh the scene mappings
-    mappings[0].size = (int)chain0Count;
-    mappings[1].size = (int)chain1Count;
-    mappings[2].size = (int)chain2Count;
-    mappings[3].size = (int)chain3Count;
-    mappings[0].offset = (int)chain0Offset;
-    mappings[1].offset = (int)chain1Offset;
-    mappings[2].offset = (int)chain2Offset;
-    mappings[3].offset = (int)chain3Offset;
+    std::vector<int> pins(MaxChains);
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      pins[i] = chains[i].count > 0 ? (int)chains[i].pin : -1;
+    }
+    return pins;
+  }
+
+  template <typename Output>
+  void updatePins(Output& output)
+  {
+    std::vector<int> pins = chainPins();
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      output.pin(i, pins[i]);
+    }
+  }
 
+  template <typename Output>
+  void updateCalibrations(Output& output)
+  {
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      output.calibration(i, chains[i].colorBalance, chains[i].gamma, chains[i].ditherBits, brightness);
+    }
+  }
+
+  template <typename Output>
+  void updatePower(Output& output)
+  {
+    output.powerModel(channelMilliamps, idleMilliamps);
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      output.powerBudget(i, powerBudget[i]);
+    }
+  }
+
+  // What the compositor should draw
+  Composition composition() const
+  {
+    return {scene, overlay, overlayMode, blendWeight(overlayOpacity), fadeTime};
+  }
+
+  // The draw buffer as a line, or as a matrix if a width is set. A height
+  // of 0 fits the height to the LED count.
+  void updateLayout(PixelMap& map, const LEDBuffer& drawBuffer)
+  {
+    int size = (int)drawBuffer.size();
+    int width = (int)layoutWidth;
+    int height = layoutHeight > 0 ? (int)layoutHeight : (size + width - 1) / std::max(width, 1);
+    if (width == 0 || !map.matrix(size, width, height, serpentine))
+    {
+      map.line(size);
+    }
+  }
+
+  void updateMappings(std::vector<ChainMapping>& mappings, LEDBuffer& drawBuffer)
+  {
+    // Refresh the scene mappings
     int drawBufSize = 0;
-    drawBufSize = std::max(drawBufSize, (int)chain0Count + chain0Offset);
-    drawBufSize = std::max(drawBufSize, (int)chain1Count + chain1Offset);
-    drawBufSize = std::max(drawBufSize, (int)chain2Count + chain2Offset);
-    drawBufSize = std::max(drawBufSize, (int)chain3Count + chain3Offset);
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      mappings[i].size = (int)chains[i].count;
+      mappings[i].offset = chains[i].offset;
+      mappings[i].reversed = chainReversed[i];
+      drawBufSize = std::max(drawBufSize, (int)chains[i].count + chains[i].offset);
+    }
     drawBufSize = std::min(drawBufSize, MAX_BUFFER_LENGTH);
 
     drawBuffer.resize(drawBufSize);
@@ -0,0 +1,392 @@
+#pragma once
+
+#include "Crc32.hpp"
+#include "DirtyRange.hpp"
+
+#include <cpp/Color.hpp>
+#include <cpp/LedStripWs2812b.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Binary frame streaming protocol, entered from the text interface with the
+// `stream` command.
+//
+// Everything is a packet with a 10 byte little-endian header:
+//
+//   0     magic        0xA5
+//   1     type         StreamPacket::Raw / Rle / Commit / Exit / Upload*
+//   2-3   sequence     incremented by one per packet, wraps
+//   4-5   offset       first LED written
+//   6-7   ledCount     number of LEDs written
+//   8-9   payloadBytes bytes following the header
+//
+// Raw payloads are ledCount RGB triplets. Rle payloads are runs of
+// [length][r][g][b] (length 1-255) covering ledCount LEDs. A sender only needs
+// to send the ranges that changed since the last frame, then a Commit packet,
+// which makes the device show the frame. Exit returns to the text interface.
+//
+// An animation image (see Animation.hpp) is uploaded with UploadBegin, whose
+// offset and ledCount fields hold the image size (low and high 16 bits), then
+// UploadData packets carrying the image bytes in order, then UploadEnd, whose
+// same two fields hold the image's CRC-32. The device answers
+// `upload ok [bytes]` or `upload failed [bytes]`.
+//
+// Packets are written straight into the draw buffer as their bytes arrive, so
+// the device never holds more than a partial pixel or run.
+
+namespace StreamPacket
+{
+  constexpr uint8_t Magic = 0xA5;
+  constexpr uint8_t Raw = 'F';
+  constexpr uint8_t Rle = 'R';
+  constexpr uint8_t Commit = 'C';
+  constexpr uint8_t Exit = 'X';
+  constexpr uint8_t UploadBegin = 'A';
+  constexpr uint8_t UploadData = 'D';
+  constexpr uint8_t UploadEnd = 'E';
+  constexpr int HeaderSize = 10;
+  constexpr int MaxPayloadBytes = 0xFFFF;
+}
+
+class StreamDecoder
+{
+public:
+  enum class Event
+  {
+    None,
+    Commit,
+    Exit,
+    // uploadValue() is the image size
+    UploadBegin,
+    // uploadData() / uploadBytes() are the next image bytes
+    UploadData,
+    // uploadValue() is the image CRC
+    UploadEnd
+  };
+
+  // Consume bytes until they run out or a Commit/Exit packet completes. Returns
+  // the number of bytes consumed; anything after an event is left for the next
+  // call so a frame is never torn across a transmit.
+  size_t feed(const uint8_t* data, size_t len, LEDBuffer& buffer, Event& event)
+  {
+    event = Event::None;
+    size_t i = 0;
+    while (i < len && event == Event::None)
+    {
+      if (state_ == State::Header)
+      {
+        if (headerLen_ == 0 && data[i] != StreamPacket::Magic)
+        {
+          // Out of sync, hunt for the next magic byte
+          ++i;
+          ++badBytes_;
+          continue;
+        }
+        header_[headerLen_++] = data[i++];
+        if (headerLen_ == StreamPacket::HeaderSize)
+        {
+          headerLen_ = 0;
+          event = beginPacket(buffer);
+        }
+      }
+      else
+      {
+        i += consumePayload(data + i, len - i, buffer, event);
+      }
+    }
+    return i;
+  }
+
+  // Forget any partial packet, e.g. when re-entering stream mode
+  void reset()
+  {
+    state_ = State::Header;
+    headerLen_ = 0;
+    partialLen_ = 0;
+    firstPacket_ = true;
+  }
+
+  // LEDs written since the last call
+  DirtyRange takeDirty()
+  {
+    DirtyRange dirty = dirty_;
+    dirty_.clear();
+    return dirty;
+  }
+
+  // The upload event just returned
+  uint32_t uploadValue() const { return uploadValue_; }
+  const uint8_t* uploadData() const { return uploadData_; }
+  size_t uploadBytes() const { return uploadBytes_; }
+
+  uint32_t framesCommitted() const { return framesCommitted_; }
+  uint32_t droppedPackets() const { return droppedPackets_; }
+  uint32_t rejectedPackets() const { return rejectedPackets_; }
+  uint32_t badBytes() const { return badBytes_; }
+
+private:
+  enum class State
+  {
+    Header,
+    Payload
+  };
+
+  static uint16_t read16(const uint8_t* p)
+  {
+    return (uint16_t)(p[0] | (p[1] << 8));
+  }
+
+  Event beginPacket(LEDBuffer& buffer)
+  {
+    type_ = header_[1];
+    uint16_t sequence = read16(header_ + 2);
+    led_ = read16(header_ + 4);
+    ledEnd_ = led_ + read16(header_ + 6);
+    payloadLeft_ = read16(header_ + 8);
+    partialLen_ = 0;
+
+    if (!firstPacket_ && sequence != (uint16_t)(sequence_ + 1))
+    {
+      droppedPackets_ += (uint16_t)(sequence - sequence_ - 1);
+    }
+    firstPacket_ = false;
+    sequence_ = sequence;
+
+    // Payloads that don't fit the buffer or type are skipped, not applied
+    bool upload = type_ == StreamPacket::UploadBegin || type_ == StreamPacket::UploadData || type_ == StreamPacket::UploadEnd;
+    if (upload)
+    {
+      uploadValue_ = read16(header_ + 4) | ((uint32_t)read16(header_ + 6) << 16);
+      discard_ = type_ != StreamPacket::UploadData && payloadLeft_ != 0;
+    }
+    else
+    {
+      discard_ = ledEnd_ > buffer.size() ||
+                 (type_ == StreamPacket::Raw && payloadLeft_ != (ledEnd_ - led_) * 3) ||
+                 (type_ != StreamPacket::Raw && type_ != StreamPacket::Rle && payloadLeft_ != 0);
+    }
+    if (discard_)
+    {
+      ++rejectedPackets_;
+    }
+    else if (!upload)
+    {
+      dirty_.mark((int)led_, (int)ledEnd_);
+    }
+
+    if (payloadLeft_ > 0)
+    {
+      state_ = State::Payload;
+      return Event::None;
+    }
+    return finishPacket();
+  }
+
+  size_t consumePayload(const uint8_t* data, size_t len, LEDBuffer& buffer, Event& event)
+  {
+    size_t n = std::min(len, (size_t)payloadLeft_);
+    payloadLeft_ -= (uint16_t)n;
+    if (type_ == StreamPacket::UploadData)
+    {
+      // Handed over as it arrives, nothing is buffered
+      uploadData_ = data;
+      uploadBytes_ = n;
+      event = Event::UploadData;
+    }
+    else if (!discard_)
+    {
+      RGBColor* out = buffer.data();
+      for (size_t i = 0; i < n; ++i)
+      {
+        partial_[partialLen_++] = data[i];
+        if (type_ == StreamPacket::Raw && partialLen_ == 3)
+        {
+          out[led_++] = RGBColor{partial_[0], partial_[1], partial_[2]};
+          partialLen_ = 0;
+        }
+        else if (type_ == StreamPacket::Rle && partialLen_ == 4)
+        {
+          uint32_t runEnd = std::min<uint32_t>(led_ + partial_[0], ledEnd_);
+          std::fill(out + led_, out + runEnd, RGBColor{partial_[1], partial_[2], partial_[3]});
+          led_ = runEnd;
+          partialLen_ = 0;
+        }
+      }
+    }
+    if (payloadLeft_ == 0)
+    {
+      state_ = State::Header;
+    }
+    return n;
+  }
+
+  Event finishPacket()
+  {
+    state_ = State::Header;
+    if (discard_) return Event::None;
+    if (type_ == StreamPacket::Commit)
+    {
+      ++framesCommitted_;
+      return Event::Commit;
+    }
+    if (type_ == StreamPacket::Exit)
+    {
+      return Event::Exit;
+    }
+    if (type_ == StreamPacket::UploadBegin)
+    {
+      return Event::UploadBegin;
+    }
+    if (type_ == StreamPacket::UploadEnd)
+    {
+      return Event::UploadEnd;
+    }
+    return Event::None;
+  }
+
+  State state_ = State::Header;
+  uint8_t header_[StreamPacket::HeaderSize];
+  int headerLen_ = 0;
+  uint8_t type_ = 0;
+  uint32_t led_ = 0;
+  uint32_t ledEnd_ = 0;
+  uint16_t payloadLeft_ = 0;
+  uint8_t partial_[4];
+  int partialLen_ = 0;
+  bool discard_ = false;
+  bool firstPacket_ = true;
+  uint16_t sequence_ = 0;
+  DirtyRange dirty_;
+  uint32_t uploadValue_ = 0;
+  const uint8_t* uploadData_ = nullptr;
+  size_t uploadBytes_ = 0;
+  uint32_t framesCommitted_ = 0;
+  uint32_t droppedPackets_ = 0;
+  uint32_t rejectedPackets_ = 0;
+  uint32_t badBytes_ = 0;
+};
+
+// Builds packets for the protocol above. Used by the host-side sender and
+// the loopback benchmark.
+class StreamEncoder
+{
+public:
+  // Append the packets for one frame to out. If previous is given (and the
+  // same size) only the ranges that changed are sent. Each range goes out as
+  // RLE or raw, whichever is smaller.
+  void encodeFrame(const LEDBuffer& frame, const LEDBuffer* previous, std::vector<uint8_t>& out)
+  {
+    const uint32_t size = (uint32_t)frame.size();
+    bool delta = previous && previous->size() == frame.size();
+    uint32_t i = 0;
+    while (i < size)
+    {
+      if (delta && same(frame[i], (*previous)[i]))
+      {
+        ++i;
+        continue;
+      }
+      // Extend the changed range until a stretch of unchanged LEDs long enough
+      // to be worth a new header
+      uint32_t end = i + 1;
+      uint32_t unchanged = 0;
+      while (end < size && end - i < MaxRangeLeds)
+      {
+        if (delta && same(frame[end], (*previous)[end]))
+        {
+          if (unchanged == 4) break;
+          ++unchanged;
+        }
+        else
+        {
+          unchanged = 0;
+        }
+        ++end;
+      }
+      end -= unchanged;
+      encodeRange(frame, i, end, out);
+      i = end;
+    }
+    packet(StreamPacket::Commit, 0, 0, nullptr, 0, out);
+  }
+
+  void encodeExit(std::vector<uint8_t>& out)
+  {
+    packet(StreamPacket::Exit, 0, 0, nullptr, 0, out);
+  }
+
+  // Append the packets that upload an animation image
+  void encodeUpload(const std::vector<uint8_t>& image, std::vector<uint8_t>& out)
+  {
+    uint32_t size = (uint32_t)image.size();
+    packet(StreamPacket::UploadBegin, size & 0xFFFF, size >> 16, nullptr, 0, out);
+    for (size_t i = 0; i < image.size(); i += UploadChunkBytes)
+    {
+      size_t n = std::min(image.size() - i, UploadChunkBytes);
+      packet(StreamPacket::UploadData, 0, 0, image.data() + i, n, out);
+    }
+    uint32_t crc = crc32(0, image.data(), image.size());
+    packet(StreamPacket::UploadEnd, crc & 0xFFFF, crc >> 16, nullptr, 0, out);
+  }
+
+private:
+  static constexpr size_t UploadChunkBytes = 4096;
+
+  // Keeps raw payloads under 64 KiB
+  static constexpr uint32_t MaxRangeLeds = StreamPacket::MaxPayloadBytes / 3;
+
+  static bool same(const RGBColor& a, const RGBColor& b)
+  {
+    return a.R == b.R && a.G == b.G && a.B == b.B;
+  }
+
+  void encodeRange(const LEDBuffer& frame, uint32_t begin, uint32_t end, std::vector<uint8_t>& out)
+  {
+    payload_.clear();
+    for (uint32_t i = begin; i < end;)
+    {
+      uint32_t run = 1;
+      while (i + run < end && run < 255 && same(frame[i + run], frame[i])) ++run;
+      payload_.push_back((uint8_t)run);
+      payload_.push_back(frame[i].R);
+      payload_.push_back(frame[i].G);
+      payload_.push_back(frame[i].B);
+      i += run;
+    }
+    uint32_t count = end - begin;
+    if (payload_.size() < count * 3 && payload_.size() <= StreamPacket::MaxPayloadBytes)
+    {
+      packet(StreamPacket::Rle, begin, count, payload_.data(), payload_.size(), out);
+      return;
+    }
+    payload_.clear();
+    for (uint32_t i = begin; i < end; ++i)
+    {
+      payload_.push_back(frame[i].R);
+      payload_.push_back(frame[i].G);
+      payload_.push_back(frame[i].B);
+    }
+    packet(StreamPacket::Raw, begin, count, payload_.data(), payload_.size(), out);
+  }
+
+  void packet(uint8_t type, uint32_t offset, uint32_t count, const uint8_t* payload, size_t payloadBytes, std::vector<uint8_t>& out)
+  {
+    uint8_t header[StreamPacket::HeaderSize] = {
+      StreamPacket::Magic, type,
+      (uint8_t)sequence_, (uint8_t)(sequence_ >> 8),
+      (uint8_t)offset, (uint8_t)(offset >> 8),
+      (uint8_t)count, (uint8_t)(count >> 8),
+      (uint8_t)payloadBytes, (uint8_t)(payloadBytes >> 8)};
+    ++sequence_;
+    out.insert(out.end(), header, header + StreamPacket::HeaderSize);
+    if (payloadBytes > 0)
+    {
+      out.insert(out.end(), payload, payload + payloadBytes);
+    }
+  }
+
+  uint16_t sequence_ = 0;
+  std::vector<uint8_t> payload_;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "ws2812_dma.pio.h"
+
+#include <pico/stdlib.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/pio.h>
+
+#include <cstddef>
+#include <cstdint>
+
+// One WS2812B chain driven by PIO and DMA without blocking the CPU.
+//
+// beginWrite() points a DMA channel at a buffer of pre-encoded words (GRB in
+// the upper 24 bits) and returns immediately; the DMA feeds the state
+// machine's FIFO at wire speed. When the DMA finishes, an alarm covers the
+// time for the FIFO to drain plus the reset latch, and only then does the
+// chain report it is no longer busy. The buffer must not change until then.
+class Ws2812bChain
+{
+public:
+  static constexpr float BitRateHz = 800000.0f;
+
+  // Words still in the joined 8-deep FIFO plus the OSR when the DMA completes,
+  // at 30 us per word, then the >= 280 us low time that latches the LEDs
+  static constexpr uint32_t DrainUs = 9 * 30;
+  static constexpr uint32_t ResetUs = 300;
+
+  // Check ok() afterwards: all state machines, program space or DMA channels
+  // may be taken
+  Ws2812bChain(uint pin) : pin_(pin)
+  {
+    if (!pio_claim_free_sm_and_add_program_for_gpio_range(&ws2812_dma_program, &pio_, &sm_, &offset_, pin, 1, true))
+    {
+      return;
+    }
+    int dma = dma_claim_unused_channel(false);
+    if (dma < 0)
+    {
+      pio_remove_program_and_unclaim_sm(&ws2812_dma_program, pio_, sm_, offset_);
+      return;
+    }
+    dma_ = (uint)dma;
+    ok_ = true;
+    ws2812_dma_program_init(pio_, sm_, offset_, pin, BitRateHz);
+
+    dma_channel_config config = dma_channel_get_default_config(dma_);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio_, sm_, true));
+    dma_channel_configure(dma_, &config, &pio_->txf[sm_], nullptr, 0, false);
+
+    chainsByDma_[dma_] = this;
+    if (!irqInstalled_)
+    {
+      irq_add_shared_handler(DMA_IRQ_0, dmaIrqHandler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+      irq_set_enabled(DMA_IRQ_0, true);
+      irqInstalled_ = true;
+    }
+    dma_channel_set_irq0_enabled(dma_, true);
+  }
+
+  ~Ws2812bChain()
+  {
+    if (!ok_) return;
+    waitComplete();
+    dma_channel_set_irq0_enabled(dma_, false);
+    chainsByDma_[dma_] = nullptr;
+    dma_channel_unclaim(dma_);
+    pio_remove_program_and_unclaim_sm(&ws2812_dma_program, pio_, sm_, offset_);
+  }
+
+  Ws2812bChain(const Ws2812bChain&) = delete;
+  Ws2812bChain& operator=(const Ws2812bChain&) = delete;
+
+  uint pin() const { return pin_; }
+  bool ok() const { return ok_; }
+
+  // Start clocking out count words. Waits for any previous write to finish.
+  void beginWrite(const uint32_t* words, size_t count)
+  {
+    waitComplete();
+    if (!ok_ || count == 0) return;
+    busy_ = true;
+    dma_channel_transfer_from_buffer_now(dma_, words, count);
+  }
+
+  bool isBusy() const
+  {
+    return busy_;
+  }
+
+  void waitComplete() const
+  {
+    while (busy_)
+    {
+      tight_loop_contents();
+    }
+  }
+
+private:
+  static void dmaIrqHandler()
+  {
+    for (uint ch = 0; ch < NUM_DMA_CHANNELS; ++ch)
+    {
+      Ws2812bChain* chain = chainsByDma_[ch];
+      if (chain && dma_channel_get_irq0_status(ch))
+      {
+        dma_channel_acknowledge_irq0(ch);
+        if (add_alarm_in_us(DrainUs + ResetUs, latchDone, chain, true) < 0)
+        {
+          // Out of alarm slots: better to risk a short latch than hang
+          chain->busy_ = false;
+        }
+      }
+    }
+  }
+
+  static int64_t latchDone(alarm_id_t, void* userData)
+  {
+    static_cast<Ws2812bChain*>(userData)->busy_ = false;
+    return 0;
+  }
+
+  static inline Ws2812bChain* chainsByDma_[NUM_DMA_CHANNELS] = {};
+  static inline bool irqInstalled_ = false;
+
+  uint pin_;
+  PIO pio_ = nullptr;
+  uint sm_ = 0;
+  uint offset_ = 0;
+  uint dma_ = 0;
+  bool ok_ = false;
+  volatile bool busy_ = false;
+};
@@ -0,0 +1,122 @@
+// Encoder for animation images (see Animation.hpp), to upload with
+// pico-led-stream-send --upload and play with the FlashAnimation scene.
+//
+// Usage: pico-led-anim-encode <out-file> --leds <n> [options]
+//   --demo           comets chasing along the strip (default)
+//   --raw <file>     raw RGB frames (leds * 3 bytes each) from a file, - for stdin
+//   --fps <f>        playback frame rate, default 20
+//   --frames <n>     stop after n frames; the demo makes 200 by default
+//   --keyframe <n>   a keyframe every n frames, default every 2 seconds
+//
+// Frames after the first are stored as deltas from the one before, so
+// animations where most LEDs hold still take far less flash than raw frames.
+
+#include "Animation.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// A few comets with fading tails, over a dim background
+static void drawDemo(LEDBuffer& frame, long index)
+{
+  const int comets = 6;
+  const int tail = 24;
+  std::fill(frame.begin(), frame.end(), RGBColor{0, 0, 8});
+  int n = (int)frame.size();
+  for (int c = 0; c < comets; ++c)
+  {
+    int head = (int)((index * (2 + c) + (long)c * n / comets) % n);
+    for (int t = 0; t < tail && t <= head; ++t)
+    {
+      uint8_t v = (uint8_t)(255 - t * 255 / tail);
+      frame[head - t] = c % 2 ? RGBColor{v, (uint8_t)(v / 3), 0} : RGBColor{0, (uint8_t)(v / 2), v};
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage: " << argv[0] << " <out-file> --leds n [--demo | --raw <file>] [--fps f] [--frames n] [--keyframe n]" << std::endl;
+    return 1;
+  }
+
+  const char* outPath = argv[1];
+  const char* rawPath = nullptr;
+  int leds = 0;
+  int fps = 20;
+  long maxFrames = -1;
+  int keyframe = -1;
+  for (int i = 2; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--demo") == 0) rawPath = nullptr;
+    else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) rawPath = argv[++i];
+    else if (strcmp(argv[i], "--leds") == 0 && i + 1 < argc) leds = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) fps = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) maxFrames = atol(argv[++i]);
+    else if (strcmp(argv[i], "--keyframe") == 0 && i + 1 < argc) keyframe = atoi(argv[++i]);
+    else
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (leds <= 0 || fps <= 0 || fps > 0xFFFF)
+  {
+    std::cerr << "need --leds and a frame rate from 1 to 65535" << std::endl;
+    return 1;
+  }
+  if (keyframe < 0) keyframe = fps * 2;
+  if (!rawPath && maxFrames < 0) maxFrames = 200;
+
+  FILE* raw = nullptr;
+  if (rawPath)
+  {
+    raw = strcmp(rawPath, "-") == 0 ? stdin : fopen(rawPath, "rb");
+    if (!raw)
+    {
+      perror(rawPath);
+      return 1;
+    }
+  }
+
+  AnimationEncoder encoder((uint32_t)leds, (uint16_t)fps, (uint32_t)keyframe);
+  LEDBuffer frame(leds);
+  std::vector<uint8_t> rawFrame(leds * 3);
+  for (long n = 0; maxFrames < 0 || n < maxFrames; ++n)
+  {
+    if (raw)
+    {
+      if (fread(rawFrame.data(), 1, rawFrame.size(), raw) != rawFrame.size()) break;
+      for (int i = 0; i < leds; ++i)
+      {
+        frame[i] = RGBColor{rawFrame[i * 3], rawFrame[i * 3 + 1], rawFrame[i * 3 + 2]};
+      }
+    }
+    else
+    {
+      drawDemo(frame, n);
+    }
+    encoder.addFrame(frame);
+  }
+  if (encoder.frames() == 0)
+  {
+    std::cerr << "no frames" << std::endl;
+    return 1;
+  }
+
+  std::vector<uint8_t> image = encoder.image();
+  FILE* out = fopen(outPath, "wb");
+  if (!out || fwrite(image.data(), 1, image.size(), out) != image.size())
+  {
+    perror(outPath);
+    return 1;
+  }
+  fclose(out);
+  std::cout << encoder.frames() << " frames, " << image.size() << " bytes ("
+            << image.size() / encoder.frames() << " bytes/frame, raw would be " << leds * 3 << ")" << std::endl;
+  return 0;
+}
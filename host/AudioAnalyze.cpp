@@ -0,0 +1,117 @@
+// Runs the firmware's audio analysis (see AudioAnalyzer.hpp) over a recording,
+// to check what the audio scenes would see without a board or a microphone.
+//
+// Usage: pico-led-audio-analyze <file.wav> [options]
+//   --csv            print every block: time, level, beat, then each band
+//   --bpm <n>        expect n beats per minute; exit with 1 if the detected
+//                    tempo is more than 3% off, for checking recorded fixtures
+//
+// The recording is mixed to mono and brought down to about the ADC's sample
+// rate first, so the bands and beat timing match the device.
+
+#include "AudioAnalyzer.hpp"
+#include "Wav.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage: " << argv[0] << " <file.wav> [--csv] [--bpm n]" << std::endl;
+    return 1;
+  }
+
+  const char* path = argv[1];
+  bool csv = false;
+  float expectedBpm = 0.0f;
+  for (int i = 2; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--csv") == 0) csv = true;
+    else if (strcmp(argv[i], "--bpm") == 0 && i + 1 < argc) expectedBpm = (float)atof(argv[++i]);
+    else
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  FILE* file = fopen(path, "rb");
+  if (!file)
+  {
+    perror(path);
+    return 1;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) bytes.insert(bytes.end(), chunk, chunk + n);
+  fclose(file);
+
+  WavAudio audio;
+  if (!parseWav(bytes, audio))
+  {
+    std::cerr << path << ": not a 16-bit PCM or 32-bit float WAV file" << std::endl;
+    return 1;
+  }
+  uint32_t rate = decimateWav(audio, AudioAnalyzer::DeviceSampleRate);
+
+  AudioAnalyzer analyzer((float)rate);
+  const int block = AudioAnalyzer::BlockSize;
+  std::vector<float> beatTimes;
+  if (csv)
+  {
+    std::cout << "time,level,beat";
+    for (int b = 0; b < AudioFeatures::Bands; ++b) std::cout << ",band" << b;
+    std::cout << std::endl;
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (size_t at = 0; at + block <= audio.samples.size(); at += block)
+  {
+    uint32_t beats = analyzer.features().beats;
+    analyzer.process(&audio.samples[at]);
+    const AudioFeatures& features = analyzer.features();
+    float time = (float)(at + block) / rate;
+    if (features.beats != beats) beatTimes.push_back(time);
+    if (csv)
+    {
+      std::cout << time << "," << features.level << "," << features.beat;
+      for (float band : features.bands) std::cout << "," << band;
+      std::cout << std::endl;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (csv) return 0;
+
+  std::cout << path << ": " << audio.samples.size() / (float)rate << " s at " << rate << " Hz, "
+            << analyzer.blocks() << " blocks of " << block << " ("
+            << (analyzer.blocks() ? seconds * 1e6 / analyzer.blocks() : 0.0) << " us each on this machine)" << std::endl;
+  std::cout << "bands (Hz):";
+  for (int b = 0; b < AudioFeatures::Bands; ++b) std::cout << " " << (int)analyzer.bandHz(b) << "-" << (int)analyzer.bandHz(b + 1);
+  std::cout << std::endl;
+
+  // Tempo from the median gap between beats, which a missed or extra beat
+  // doesn't throw off
+  float bpm = 0.0f;
+  if (beatTimes.size() >= 2)
+  {
+    std::vector<float> gaps;
+    for (size_t i = 1; i < beatTimes.size(); ++i) gaps.push_back(beatTimes[i] - beatTimes[i - 1]);
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    bpm = 60.0f / gaps[gaps.size() / 2];
+  }
+  std::cout << beatTimes.size() << " beats, " << bpm << " bpm" << std::endl;
+
+  if (expectedBpm > 0.0f && std::abs(bpm - expectedBpm) > expectedBpm * 0.03f)
+  {
+    std::cout << "expected " << expectedBpm << " bpm" << std::endl;
+    return 1;
+  }
+  return 0;
+}
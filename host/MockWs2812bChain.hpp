@@ -0,0 +1,60 @@
+#pragma once
+
+// Host stand-in for Ws2812bChain. beginWrite() copies the words into wire()
+// as if they had been clocked out. With wireTime enabled the chain also stays
+// busy for as long as the real 800 kHz transfer and reset latch would take,
+// so the bench can show what overlapping the transmit buys.
+
+#include <pico/stdlib.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+class MockWs2812bChain
+{
+public:
+  static inline bool wireTime = false;
+
+  MockWs2812bChain(uint pin) : pin_(pin) {}
+
+  MockWs2812bChain(const MockWs2812bChain&) = delete;
+  MockWs2812bChain& operator=(const MockWs2812bChain&) = delete;
+
+  uint pin() const { return pin_; }
+  bool ok() const { return true; }
+
+  // The words most recently sent and how many writes there have been
+  const std::vector<uint32_t>& wire() const { return wire_; }
+  int writes() const { return writes_; }
+
+  void beginWrite(const uint32_t* words, size_t count)
+  {
+    waitComplete();
+    if (count == 0) return;
+    wire_.assign(words, words + count);
+    ++writes_;
+    if (wireTime)
+    {
+      busyUntil_ = std::chrono::steady_clock::now() + std::chrono::microseconds(count * 30 + 300);
+    }
+  }
+
+  bool isBusy() const
+  {
+    return std::chrono::steady_clock::now() < busyUntil_;
+  }
+
+  void waitComplete() const
+  {
+    std::this_thread::sleep_until(busyUntil_);
+  }
+
+private:
+  uint pin_;
+  std::vector<uint32_t> wire_;
+  int writes_ = 0;
+  std::chrono::steady_clock::time_point busyUntil_ {};
+};
@@ -0,0 +1,1805 @@
+// Frame rendering benchmark for the host build.
+//
+// Runs every registered scene through the same update + transmit sequence as
+// the firmware main loop at a range of LED counts and reports the cost per LED
+// and the frame rate that leaves. The numbers are host numbers, so compare runs
+// against each other rather than against the 20 FPS budget on the RP2040.
+//
+// Usage: pico-led-bench [section...]
+// Sections: scenes, registry, idle, layout, hue, pipeline, transmit, overlap,
+// dither, stream, blend, spike, stats, serial, journal, preset, power, anim,
+// audio, particles, pattern. With no arguments every section runs.
+
+#include <iostream>
+
+#include "Animation.hpp"
+#include "AudioAnalyzer.hpp"
+#include "Compositor.hpp"
+#include "FlashJournal.hpp"
+#include "FrameStats.hpp"
+#include "LedOutput.hpp"
+#include "MockWs2812bChain.hpp"
+#include "Presets.hpp"
+#include "RenderPipeline.hpp"
+#include "Scene.hpp"
+#include "SerialTx.hpp"
+#include "Settings.hpp"
+#include "SimFlash.hpp"
+#include "StreamProtocol.hpp"
+#include "Wav.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <malloc.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t cycleCount() { return __rdtsc(); }
+#define HAVE_CYCLE_COUNT 1
+#else
+static inline uint64_t cycleCount() { return 0; }
+#define HAVE_CYCLE_COUNT 0
+#endif
+
+using BenchClock = std::chrono::steady_clock;
+
+static constexpr float BenchFrameTimeSec = 1.0f / 20.0f;
+static constexpr double MinBenchTimeSec = 0.25;
+static constexpr int MinBenchFrames = 10;
+static constexpr int WarmupFrames = 3;
+
+// Where the sections get their scenes from
+static SceneList Scenes;
+
+struct BenchResult
+{
+  int frames = 0;
+  double updateSec = 0.0;
+  double frameSec = 0.0;
+};
+
+static double secondsSince(BenchClock::time_point start)
+{
+  return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static bool sameBuffer(const LEDBuffer& a, const LEDBuffer& b)
+{
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i)
+  {
+    if (a[i].R != b[i].R || a[i].G != b[i].G || a[i].B != b[i].B) return false;
+  }
+  return true;
+}
+
+static BenchResult benchScene(Scene& scene, uint32_t ledCount, float param)
+{
+  // Configure a single chain the same way the count command would
+  Settings settings;
+  settings.setDefaults();
+  settings.chains[0].count = ledCount;
+  settings.param = param;
+
+  LEDBuffer drawBuffer;
+  LedOutput<MockWs2812bChain> output(settings.chainPins());
+  settings.updateCalibrations(output);
+  settings.updateMappings(output.mappings(), drawBuffer);
+
+  // Every frame is a full redraw, so static scenes are measured too (the
+  // idle section covers skipping unchanged frames)
+  for (int i = 0; i < WarmupFrames; ++i)
+  {
+    scene.invalidate();
+    scene.update(drawBuffer, BenchFrameTimeSec, settings.param);
+    output.write(drawBuffer, settings.brightness);
+  }
+
+  BenchResult result;
+  auto benchStart = BenchClock::now();
+  while (result.frames < MinBenchFrames || secondsSince(benchStart) < MinBenchTimeSec)
+  {
+    auto frameStart = BenchClock::now();
+    scene.invalidate();
+    scene.update(drawBuffer, BenchFrameTimeSec, settings.param);
+    result.updateSec += secondsSince(frameStart);
+    output.write(drawBuffer, settings.brightness);
+    result.frameSec += secondsSince(frameStart);
+    ++result.frames;
+  }
+  return result;
+}
+
+static void benchScenes()
+{
+  const uint32_t ledCounts[] = {1, 300, 2500, MAX_BUFFER_LENGTH};
+  const float param = 0.5f;
+
+  std::cout << "== scenes ==" << std::endl;
+  std::cout << std::left
+            << std::setw(18) << "scene"
+            << std::setw(8) << "leds"
+            << std::setw(10) << "frames"
+            << std::setw(16) << "update ns/led"
+            << std::setw(16) << "frame ns/led"
+            << std::setw(12) << "fps" << std::endl;
+
+  for (size_t s = 0; s < Scenes.size(); ++s)
+  {
+    for (uint32_t ledCount : ledCounts)
+    {
+      BenchResult r = benchScene(Scenes.activate(s), ledCount, param);
+      double updateNsPerLed = r.updateSec * 1e9 / ((double)r.frames * ledCount);
+      double frameNsPerLed = r.frameSec * 1e9 / ((double)r.frames * ledCount);
+      double fps = (double)r.frames / r.frameSec;
+      std::cout << std::left
+                << std::setw(18) << Scenes.name(s)
+                << std::setw(8) << ledCount
+                << std::setw(10) << r.frames
+                << std::fixed << std::setprecision(2)
+                << std::setw(16) << updateNsPerLed
+                << std::setw(16) << frameNsPerLed
+                << std::setprecision(1)
+                << std::setw(12) << fps << std::endl;
+    }
+  }
+  std::cout << std::endl;
+}
+
+// Heap in use, for the registry section. glibc only; 0 elsewhere. Small
+// blocks freed last stay in glibc's per-thread cache and still count, so run
+// with GLIBC_TUNABLES=glibc.malloc.tcache_count=0 for exact numbers.
+static size_t heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+// Memory the scene table holds: the arena against every scene constructed
+// at once (what the old static registration did at boot), and the heap a
+// scene's own buffers hold while it's active
+static void benchRegistry()
+{
+  std::cout << "== registry ==" << std::endl;
+  std::cout << "scene objects, all constructed:    " << SceneList::TotalSize << " bytes in " << Scenes.size() << " heap blocks" << std::endl;
+  std::cout << "scene arena:    " << SceneList::ArenaSize << " bytes, no heap blocks" << std::endl;
+
+  std::cout << std::left << std::setw(18) << "scene"
+            << std::setw(16) << "heap bytes" << std::endl;
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  Scenes.deactivate();
+  size_t baseline = heapInUse();
+  for (int s = 0; s < Scenes.size(); ++s)
+  {
+    Scene& scene = Scenes.activate(s);
+    scene.update(drawBuffer, BenchFrameTimeSec, 0.5f);
+    std::cout << std::left << std::setw(18) << Scenes.name(s)
+              << std::setw(16) << (long)(heapInUse() - baseline) << std::endl;
+  }
+  Scenes.deactivate();
+  std::cout << "after switching away:    " << (long)(heapInUse() - baseline) << " heap bytes" << std::endl;
+  std::cout << std::endl;
+}
+
+// Steady-state frame cost at MAX_BUFFER_LENGTH LEDs over 4 chains when
+// unchanged frames and chains are skipped, against redrawing and resending
+// everything every frame
+static void benchIdle()
+{
+  std::cout << "== idle ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "scene"
+            << std::setw(16) << "full us/frame"
+            << std::setw(16) << "dirty us/frame"
+            << std::setw(16) << "chain writes" << std::endl;
+
+  const int chainSize = MAX_BUFFER_LENGTH / 4;
+  const int frames = 200;
+  for (size_t s = 0; s < Scenes.size(); ++s)
+  {
+    LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+    LedOutput<MockWs2812bChain> output({22, 26, 27, 28});
+    for (int c = 0; c < 4; ++c)
+    {
+      output.mappings()[c] = {chainSize, c * chainSize};
+    }
+
+    Scene& scene = Scenes.activate(s);
+    auto start = BenchClock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+      scene.invalidate();
+      scene.update(drawBuffer, BenchFrameTimeSec, 0.5f);
+      output.beginWrite(drawBuffer, 1.0f);
+    }
+    double fullSec = secondsSince(start);
+
+    int writesBefore = output.chain(0).writes();
+    DirtyRange dirty;
+    start = BenchClock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+      if (scene.update(drawBuffer, BenchFrameTimeSec, 0.5f)) dirty.markAll();
+      output.beginWrite(drawBuffer, 1.0f, dirty);
+      dirty.clear();
+    }
+    double dirtySec = secondsSince(start);
+
+    std::cout << std::left << std::setw(18) << Scenes.name(s)
+              << std::fixed << std::setprecision(2)
+              << std::setw(16) << fullSec * 1e6 / frames
+              << std::setw(16) << dirtySec * 1e6 / frames
+              << output.chain(0).writes() - writesBefore << "/" << frames << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+// Scene cost on a 100x100 serpentine matrix against the same LEDs as a line,
+// and a check that a reversed chain sends the same words back to front
+static void benchLayout()
+{
+  std::cout << "== layout ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "scene"
+            << std::setw(16) << "line ns/led"
+            << std::setw(16) << "matrix ns/led" << std::endl;
+
+  const int frames = 200;
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  PixelMap line;
+  line.line(MAX_BUFFER_LENGTH);
+  PixelMap matrix;
+  matrix.matrix(MAX_BUFFER_LENGTH, 100, 100, true);
+
+  for (size_t s = 0; s < Scenes.size(); ++s)
+  {
+    std::cout << std::left << std::setw(18) << Scenes.name(s) << std::fixed << std::setprecision(2);
+    Scene& scene = Scenes.activate(s);
+    for (const PixelMap* map : {&line, &matrix})
+    {
+      Scenes.layout(map);
+      auto start = BenchClock::now();
+      for (int f = 0; f < frames; ++f)
+      {
+        scene.invalidate();
+        scene.update(drawBuffer, BenchFrameTimeSec, 0.5f);
+      }
+      std::cout << std::setw(16) << secondsSince(start) * 1e9 / ((double)frames * drawBuffer.size());
+    }
+    std::cout << std::endl;
+  }
+  Scenes.layout(nullptr);
+
+  LedOutput<MockWs2812bChain> output({22, 26});
+  output.mappings()[0] = {MAX_BUFFER_LENGTH, 0, false};
+  output.mappings()[1] = {MAX_BUFFER_LENGTH, 0, true};
+  fillHueRamp(drawBuffer, 0, (uint32_t)(0x100000000ull / drawBuffer.size()));
+  output.write(drawBuffer, 1.0f);
+  auto forward = output.chain(0).wire();
+  auto backward = output.chain(1).wire();
+  if (!std::equal(forward.begin(), forward.end(), backward.rbegin()))
+  {
+    std::cout << "reversed chain mismatch!" << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+template <typename Kernel>
+static void benchKernel(const char* name, LEDBuffer& buffer, Kernel kernel)
+{
+  const int iterations = 200;
+  kernel(0);
+  auto start = BenchClock::now();
+  uint64_t startCycles = cycleCount();
+  for (int i = 0; i < iterations; ++i)
+  {
+    kernel(i);
+  }
+  uint64_t cycles = cycleCount() - startCycles;
+  double sec = secondsSince(start);
+  double leds = (double)iterations * buffer.size();
+  std::cout << std::left << std::setw(18) << name
+            << std::fixed << std::setprecision(2)
+            << std::setw(16) << sec * 1e9 / leds;
+  if (HAVE_CYCLE_COUNT)
+    std::cout << std::setw(16) << (double)cycles / leds;
+  else
+    std::cout << std::setw(16) << "n/a";
+  std::cout << std::endl;
+}
+
+// Float HSV rainbow (what GamerRGB used to do) against the fixed-point table
+static void benchHue()
+{
+  std::cout << "== hue ==" << std::endl;
+  LEDBuffer buffer(MAX_BUFFER_LENGTH);
+  std::cout << std::left << std::setw(18) << "kernel"
+            << std::setw(16) << "ns/led"
+            << std::setw(16) << "cycles/led" << std::endl;
+  benchKernel("float HSV", buffer, [&](int i)
+  {
+    fillHueRampFloat(buffer, (float)(i % 360));
+  });
+  benchKernel("fixed-point LUT", buffer, [&](int i)
+  {
+    fillHueRamp(buffer, (uint32_t)hueFromDegrees((float)(i % 360)) << 16, (uint32_t)(0x100000000ull / buffer.size()));
+  });
+
+  // Accuracy of the integer HSV kernel against the float conversion
+  int maxError = 0;
+  for (int h = 0; h < 360; h += 3)
+  {
+    for (int sv = 0; sv <= 255; sv += 15)
+    {
+      RGBColor a = HSVColor{(float)h, sv / 255.0f, sv / 255.0f}.toRGB();
+      RGBColor b = hsvToRGB(hueFromDegrees((float)h), (uint8_t)sv, (uint8_t)sv);
+      maxError = std::max(maxError, std::abs((int)a.R - (int)b.R));
+      maxError = std::max(maxError, std::abs((int)a.G - (int)b.G));
+      maxError = std::max(maxError, std::abs((int)a.B - (int)b.B));
+    }
+  }
+  std::cout << "hsvToRGB max error vs HSVColor: " << maxError << " LSB" << std::endl;
+  std::cout << std::endl;
+}
+
+// Same frame sequence as the firmware loop, serial and with the render
+// pipeline on a second thread, at MAX_BUFFER_LENGTH LEDs
+static void benchPipeline()
+{
+  std::cout << "== pipeline ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "scene"
+            << std::setw(16) << "serial fps"
+            << std::setw(16) << "pipelined fps" << std::endl;
+
+  const int frames = 200;
+  const uint32_t ledCount = MAX_BUFFER_LENGTH;
+  LedOutput<MockWs2812bChain> output({22});
+  output.mappings()[0] = {(int)ledCount, 0};
+
+  for (size_t s = 0; s < Scenes.size(); ++s)
+  {
+    LEDBuffer drawBuffer(ledCount);
+    auto start = BenchClock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+      Scene& scene = Scenes.activate(s);
+      scene.invalidate();
+      scene.update(drawBuffer, BenchFrameTimeSec, 0.5f);
+      output.write(drawBuffer, 1.0f);
+    }
+    double serialFps = frames / secondsSince(start);
+
+    RenderPipeline pipeline;
+    std::thread renderer([&]() { pipeline.runRenderer(); });
+    start = BenchClock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+      pipeline.collect(drawBuffer);
+      pipeline.post({{(int)s}, BenchFrameTimeSec, 0.5f, ledCount, true, {}});
+      output.write(drawBuffer, 1.0f);
+    }
+    pipeline.collect(drawBuffer);
+    double pipelinedFps = frames / secondsSince(start);
+    pipeline.stop();
+    renderer.join();
+    SceneCompositor.reset();
+
+    std::cout << std::left << std::setw(18) << Scenes.name(s)
+              << std::fixed << std::setprecision(1)
+              << std::setw(16) << serialFps
+              << std::setw(16) << pipelinedFps << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+// Calibrate + encode at MAX_BUFFER_LENGTH LEDs: per-LED float gamma/balance/
+// brightness against the folded tables in LedOutput
+static void benchTransmit()
+{
+  std::cout << "== transmit ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "kernel"
+            << std::setw(16) << "ns/led"
+            << std::setw(16) << "cycles/led" << std::endl;
+
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  fillHueRamp(drawBuffer, 0, (uint32_t)(0x100000000ull / drawBuffer.size()));
+  const Vec3f balance {1.0f, 0.8f, 0.7f};
+  const float gamma = 2.2f;
+
+  std::vector<uint32_t> words(drawBuffer.size());
+  benchKernel("float per-LED", drawBuffer, [&](int i)
+  {
+    float brightness = (i & 1) ? 0.5f : 0.6f;
+    for (size_t j = 0; j < drawBuffer.size(); ++j)
+    {
+      const RGBColor& c = drawBuffer[j];
+      uint32_t r = (uint32_t)(std::pow(c.R / 255.0f, gamma) * balance.X * brightness * 255.0f);
+      uint32_t g = (uint32_t)(std::pow(c.G / 255.0f, gamma) * balance.Y * brightness * 255.0f);
+      uint32_t b = (uint32_t)(std::pow(c.B / 255.0f, gamma) * balance.Z * brightness * 255.0f);
+      words[j] = (g << 24) | (r << 16) | (b << 8);
+    }
+  });
+
+  LedOutput<MockWs2812bChain> output({22});
+  output.mappings()[0] = {(int)drawBuffer.size(), 0};
+  output.calibration(0, balance, gamma);
+  benchKernel("LUT", drawBuffer, [&](int)
+  {
+    output.write(drawBuffer, 0.5f);
+  });
+  benchKernel("LUT + rebuild", drawBuffer, [&](int i)
+  {
+    // Brightness changing every frame, as when the button is held
+    output.write(drawBuffer, (i & 1) ? 0.5f : 0.6f);
+  });
+  std::cout << std::endl;
+}
+
+// Frame rate with the chains taking real wire time (4 chains of
+// MAX_BUFFER_LENGTH / 4, about 75 ms each), waiting for every frame to latch
+// against starting the transfer and moving on. Render time is simulated with a
+// sleep so the host's speed doesn't hide the overlap; on the device it is the
+// scene, input and encode cost.
+static void benchOverlap()
+{
+  std::cout << "== overlap ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "render ms"
+            << std::setw(16) << "write fps"
+            << std::setw(16) << "beginWrite fps" << std::endl;
+
+  const int chainSize = MAX_BUFFER_LENGTH / 4;
+  const int frames = 10;
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  LedOutput<MockWs2812bChain> output({22, 26, 27, 28});
+  for (int c = 0; c < 4; ++c)
+  {
+    output.mappings()[c] = {chainSize, c * chainSize};
+  }
+  MockWs2812bChain::wireTime = true;
+
+  for (int renderMs : {0, 25, 50, 75})
+  {
+    std::cout << std::left << std::setw(18) << renderMs;
+    for (bool async : {false, true})
+    {
+      auto start = BenchClock::now();
+      for (int f = 0; f < frames; ++f)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(renderMs));
+        if (async)
+          output.beginWrite(drawBuffer, 1.0f);
+        else
+          output.write(drawBuffer, 1.0f);
+      }
+      output.waitComplete();
+      std::cout << std::fixed << std::setprecision(1) << std::setw(16) << frames / secondsSince(start);
+    }
+    std::cout << std::endl;
+  }
+  MockWs2812bChain::wireTime = false;
+  std::cout << std::endl;
+}
+
+// Extra cost of temporal dithering at MAX_BUFFER_LENGTH LEDs, and the longest
+// repeat period of the dither pattern for each setting. The slowest flicker a
+// dithered LED can show is fps / period, so keeping that above ~60 Hz (where a
+// 1 LSB modulation fuses) needs fps >= 60 * period.
+static void benchDither()
+{
+  std::cout << "== dither ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "bits"
+            << std::setw(16) << "ns/led"
+            << std::setw(16) << "cycles/led"
+            << std::setw(16) << "max period"
+            << std::setw(16) << "min fps" << std::endl;
+
+  const float brightness = 0.1f;
+  const float gamma = 2.2f;
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  for (size_t i = 0; i < drawBuffer.size(); ++i)
+  {
+    uint8_t v = (uint8_t)(i * 256 / drawBuffer.size());
+    drawBuffer[i] = RGBColor{v, v, v};
+  }
+
+  for (int bits : {0, 2, 4, 6, 8})
+  {
+    LedOutput<MockWs2812bChain> output({22});
+    output.mappings()[0] = {(int)drawBuffer.size(), 0};
+    output.calibration(0, {1.0f, 1.0f, 1.0f}, gamma, bits);
+
+    // Record the red channel of a ramp long enough to repeat twice
+    const int frames = 2 << std::max(bits, 1);
+    std::vector<std::vector<uint8_t>> history(256, std::vector<uint8_t>(frames));
+    for (int f = 0; f < frames; ++f)
+    {
+      output.write(drawBuffer, brightness);
+      for (int level = 0; level < 256; ++level)
+      {
+        size_t led = (size_t)level * drawBuffer.size() / 256;
+        history[level][f] = (uint8_t)(output.chain(0).wire()[led] >> 16);
+      }
+    }
+    int maxPeriod = 1;
+    for (auto& seq : history)
+    {
+      int period = 1;
+      while (period < frames / 2)
+      {
+        bool repeats = true;
+        for (int f = frames / 2; f + period < frames && repeats; ++f)
+        {
+          repeats = seq[f] == seq[f + period];
+        }
+        if (repeats) break;
+        ++period;
+      }
+      maxPeriod = std::max(maxPeriod, period);
+    }
+
+    std::cout << std::left << std::setw(18) << bits;
+    auto start = BenchClock::now();
+    uint64_t startCycles = cycleCount();
+    const int iterations = 100;
+    for (int i = 0; i < iterations; ++i)
+    {
+      output.write(drawBuffer, brightness);
+    }
+    double leds = (double)iterations * drawBuffer.size();
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(16) << secondsSince(start) * 1e9 / leds;
+    if (HAVE_CYCLE_COUNT)
+      std::cout << std::setw(16) << (double)(cycleCount() - startCycles) / leds;
+    else
+      std::cout << std::setw(16) << "n/a";
+    std::cout << std::setw(16) << maxPeriod
+              << std::setw(16) << (bits == 0 ? 0 : 60 * maxPeriod) << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+// Encode + decode loopback of the streaming protocol. Shows how many frames per
+// second the protocol itself can carry and how many bytes each frame costs on
+// the wire (USB full speed CDC tops out around 1 MB/s).
+static void benchStream()
+{
+  std::cout << "== stream ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "content"
+            << std::setw(8) << "leds"
+            << std::setw(16) << "bytes/frame"
+            << std::setw(16) << "loopback fps"
+            << std::setw(16) << "decode ns/led" << std::endl;
+
+  for (uint32_t ledCount : {1000u, (uint32_t)MAX_BUFFER_LENGTH})
+  {
+    for (int content = 0; content < 3; ++content)
+    {
+      const char* names[] = {"rainbow", "sparse delta", "solid"};
+      LEDBuffer frame(ledCount);
+      LEDBuffer previous;
+      LEDBuffer received(ledCount);
+      StreamEncoder encoder;
+      StreamDecoder decoder;
+      std::vector<uint8_t> packets;
+      const int frames = 100;
+      size_t bytes = 0;
+      double decodeSec = 0.0;
+      auto start = BenchClock::now();
+      for (int f = 0; f < frames; ++f)
+      {
+        if (content == 0)
+          fillHueRamp(frame, (uint32_t)f << 26, (uint32_t)(0x100000000ull / ledCount));
+        else if (content == 1)
+          frame[(f * 7919) % ledCount] = RGBColor{(uint8_t)f, 255, 0};
+        else
+          std::fill(frame.begin(), frame.end(), RGBColor{(uint8_t)f, 10, 20});
+
+        packets.clear();
+        encoder.encodeFrame(frame, previous.empty() ? nullptr : &previous, packets);
+        previous = frame;
+        bytes += packets.size();
+
+        auto decodeStart = BenchClock::now();
+        size_t pos = 0;
+        StreamDecoder::Event event = StreamDecoder::Event::None;
+        while (pos < packets.size() && event != StreamDecoder::Event::Commit)
+        {
+          pos += decoder.feed(packets.data() + pos, packets.size() - pos, received, event);
+        }
+        decodeSec += secondsSince(decodeStart);
+      }
+      double sec = secondsSince(start);
+      if (!sameBuffer(received, frame) || decoder.framesCommitted() != frames)
+      {
+        std::cout << "loopback mismatch!" << std::endl;
+      }
+      std::cout << std::left << std::setw(18) << names[content]
+                << std::setw(8) << ledCount
+                << std::setw(16) << bytes / frames
+                << std::fixed << std::setprecision(1)
+                << std::setw(16) << frames / sec
+                << std::setprecision(2)
+                << std::setw(16) << decodeSec * 1e9 / ((double)frames * ledCount) << std::endl;
+    }
+  }
+  std::cout << std::endl;
+}
+
+// Float RGBColor::blend per LED against the packed kernels at 1k and
+// MAX_BUFFER_LENGTH LEDs, their accuracy against RGBColor::blend, then what a
+// compositor frame costs at MAX_BUFFER_LENGTH with a fade or an overlay on top
+// of the scene render
+static void benchBlend()
+{
+  std::cout << "== blend ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "kernel"
+            << std::setw(16) << "ns/led"
+            << std::setw(16) << "cycles/led" << std::endl;
+  for (int ledCount : {1000, MAX_BUFFER_LENGTH})
+  {
+    LEDBuffer a(ledCount);
+    LEDBuffer b(ledCount);
+    LEDBuffer out(ledCount);
+    fillHueRamp(a, 0, (uint32_t)(0x100000000ull / ledCount));
+    fillHueRamp(b, 0x80000000u, (uint32_t)(0x100000000ull / ledCount));
+    std::string leds = " " + std::to_string(ledCount / 1000) + "k";
+    benchKernel(("float blend" + leds).c_str(), out, [&](int i)
+    {
+      float t = (float)(i & 255) / 255.0f;
+      for (int j = 0; j < ledCount; ++j)
+      {
+        out[j] = RGBColor::blend(a[j], b[j], t);
+      }
+    });
+    benchKernel(("packed color" + leds).c_str(), out, [&](int i)
+    {
+      uint32_t t = (uint32_t)(i & 255);
+      for (int j = 0; j < ledCount; ++j)
+      {
+        out[j] = blendColor(a[j], b[j], t);
+      }
+    });
+    benchKernel(("packed buffer" + leds).c_str(), out, [&](int i)
+    {
+      blendBuffers(out, a, b, (uint32_t)(i & 255));
+    });
+    benchKernel(("packed add" + leds).c_str(), out, [&](int i)
+    {
+      addBuffers(out, b, (uint32_t)(i & 255));
+    });
+  }
+
+  // Every channel pair on a coarse grid, at weights across the range
+  int maxError = 0;
+  int addError = 0;
+  for (int ca = 0; ca <= 255; ca += 5)
+  {
+    for (int cb = 0; cb <= 255; cb += 3)
+    {
+      RGBColor a {(uint8_t)ca, (uint8_t)(255 - ca), (uint8_t)cb};
+      RGBColor b {(uint8_t)cb, (uint8_t)ca, (uint8_t)(255 - cb)};
+      for (int step = 0; step <= 64; ++step)
+      {
+        float t = step / 64.0f;
+        RGBColor expected = RGBColor::blend(a, b, t);
+        RGBColor packed = blendColor(a, b, blendWeight(t));
+        maxError = std::max(maxError, std::abs((int)expected.R - (int)packed.R));
+        maxError = std::max(maxError, std::abs((int)expected.G - (int)packed.G));
+        maxError = std::max(maxError, std::abs((int)expected.B - (int)packed.B));
+
+        uint32_t w = blendWeight(t);
+        RGBColor sum = a;
+        addBuffers(&sum, &b, 1, w);
+        addError = std::max(addError, std::abs(std::min(ca + (int)((cb * w) >> 8), 255) - (int)sum.R));
+        addError = std::max(addError, std::abs(std::min(255 - ca + (int)((ca * w) >> 8), 255) - (int)sum.G));
+        addError = std::max(addError, std::abs(std::min(cb + (int)(((255 - cb) * w) >> 8), 255) - (int)sum.B));
+      }
+    }
+  }
+  std::cout << "blendColor max error vs RGBColor::blend: " << maxError << " LSB" << std::endl;
+  std::cout << "addBuffers max error vs per-channel add: " << addError << " LSB" << std::endl;
+  if (maxError > 1 || addError > 0)
+  {
+    std::cout << "packed blend out of tolerance!" << std::endl;
+  }
+
+  struct Case
+  {
+    const char* name;
+    Composition composition;
+  };
+  const Case cases[] = {
+    {"GamerRGB", {1}},
+    {"GamerRGB > Halloween", {2, Composition::NoScene, BlendMode::Alpha, BlendOne, 1000.0f}},
+    {"GamerRGB + Halloween", {1, 2, BlendMode::Add, BlendOne / 2}},
+  };
+  std::cout << std::left << std::setw(24) << "composition"
+            << std::setw(16) << "us/frame" << std::endl;
+  const int frames = 200;
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  for (const Case& c : cases)
+  {
+    // Start from GamerRGB alone, so the fade case is mid-fade throughout
+    SceneCompositor.reset();
+    SceneCompositor.render(drawBuffer, cases[0].composition, BenchFrameTimeSec, 0.5f);
+    auto start = BenchClock::now();
+    for (int f = 0; f < frames; ++f)
+    {
+      SceneCompositor.render(drawBuffer, c.composition, BenchFrameTimeSec, 0.5f);
+    }
+    std::cout << std::left << std::setw(24) << c.name
+              << std::fixed << std::setprecision(1)
+              << std::setw(16) << secondsSince(start) * 1e6 / frames << std::endl;
+  }
+  SceneCompositor.reset();
+  std::cout << std::endl;
+}
+
+// Halloween as it was: libc rand() with a float divide, and every LED given
+// a new color in the same frame whenever the fade cycle rolled over. Kept as
+// the baseline for the spike section.
+class BurstHalloween : public Scene
+{
+public:
+  BurstHalloween()
+  {
+    srand(349875232);
+  }
+
+  virtual bool update(LEDBuffer& buffer, float deltaTime, float /* param */) override
+  {
+    src_.resize(buffer.size());
+    dst_.resize(buffer.size());
+    t_ += deltaTime;
+    if (t_ >= FadeTime)
+    {
+      dst_.swap(src_);
+      for (RGBColor& color : dst_)
+      {
+        float hue = randFloat(10.0f, 20.0f);
+        float saturation = randFloat(0.9f, 1.0f);
+        float value = randFloat(0.3f, 0.7f);
+        color = hsvToRGB(hueFromDegrees(hue), (uint8_t)(saturation * 255.0f), (uint8_t)(value * 255.0f));
+      }
+    }
+    while (t_ >= FadeTime)
+    {
+      t_ -= FadeTime;
+    }
+    float t = t_ / FadeTime;
+    for (size_t i = 0; i < buffer.size(); ++i)
+    {
+      buffer[i] = RGBColor::blend(src_[i], dst_[i], t);
+    }
+    return true;
+  }
+
+private:
+  static constexpr float FadeTime = 4.0f;
+
+  static float randFloat(float min, float max)
+  {
+    return min + (float)rand() / ((float)RAND_MAX / (max - min));
+  }
+
+  float t_ = FadeTime;
+  LEDBuffer src_;
+  LEDBuffer dst_;
+};
+
+// Per-frame update time of Halloween at MAX_BUFFER_LENGTH LEDs over several
+// fade cycles: the old burst of new colors against the per-scene generator
+// spreading them across frames. The worst frame should stay near the median.
+// Also the raw generator cost against rand().
+static void benchSpike()
+{
+  std::cout << "== spike ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "halloween"
+            << std::setw(16) << "median us"
+            << std::setw(16) << "p99 us"
+            << std::setw(16) << "max us" << std::endl;
+
+  const int frames = 400;
+  LEDBuffer drawBuffer(MAX_BUFFER_LENGTH);
+  BurstHalloween burst;
+  Halloween spread;
+  for (Scene* scene : {(Scene*)&burst, (Scene*)&spread})
+  {
+    // The first frame sizes the buffers and fills them, which isn't steady state
+    scene->update(drawBuffer, BenchFrameTimeSec, 0.5f);
+    std::vector<double> times;
+    for (int f = 0; f < frames; ++f)
+    {
+      auto start = BenchClock::now();
+      scene->update(drawBuffer, BenchFrameTimeSec, 0.5f);
+      times.push_back(secondsSince(start) * 1e6);
+    }
+    std::sort(times.begin(), times.end());
+    std::cout << std::left << std::setw(18) << (scene == &burst ? "burst, rand()" : "spread, Random")
+              << std::fixed << std::setprecision(1)
+              << std::setw(16) << times[frames / 2]
+              << std::setw(16) << times[frames * 99 / 100]
+              << std::setw(16) << times.back() << std::endl;
+  }
+
+  std::cout << std::left << std::setw(18) << "generator"
+            << std::setw(16) << "ns/value" << std::endl;
+  std::vector<uint32_t> values(MAX_BUFFER_LENGTH);
+  const int rounds = 100;
+  srand(1);
+  auto start = BenchClock::now();
+  for (int r = 0; r < rounds; ++r)
+  {
+    for (uint32_t& v : values) v = (uint32_t)rand();
+  }
+  double randNs = secondsSince(start) * 1e9 / ((double)rounds * values.size());
+  Random random;
+  start = BenchClock::now();
+  for (int r = 0; r < rounds; ++r)
+  {
+    random.fill(values.data(), values.size());
+  }
+  double fillNs = secondsSince(start) * 1e9 / ((double)rounds * values.size());
+  std::cout << std::left << std::setw(18) << "rand()" << std::fixed << std::setprecision(2) << randNs << std::endl;
+  std::cout << std::left << std::setw(18) << "Random::fill" << fillNs << std::endl;
+  std::cout << std::endl;
+}
+
+// What FrameStats costs per timed phase, and how close its histogram p99
+// gets to the exact one on a long-tailed spread of frame times
+static void benchStats()
+{
+  std::cout << "== stats ==" << std::endl;
+  FrameStats stats;
+  const int frames = 100000;
+  auto start = BenchClock::now();
+  for (int f = 0; f < frames; ++f)
+  {
+    stats.frameStart();
+    stats.lap(FramePhase::Input);
+    stats.lap(FramePhase::Buttons);
+    stats.lap(FramePhase::Autosave);
+    stats.lap(FramePhase::Render);
+    stats.lap(FramePhase::Transmit);
+    stats.frameEnd(false);
+  }
+  double lapNs = secondsSince(start) * 1e9 / ((double)frames * 6);
+  std::cout << "cost per timed phase:    " << std::fixed << std::setprecision(1) << lapNs << " ns" << std::endl;
+
+  // Mostly 20-30 ms with a tail out to 200 ms
+  FrameStats synthetic;
+  synthetic.windowUs(1);
+  synthetic.frameStart();
+  Random random(1);
+  std::vector<uint32_t> samples(20000);
+  for (uint32_t& us : samples)
+  {
+    us = (uint32_t)random.range(20000, 30000);
+    if (random.range(0, 99) < 3) us = (uint32_t)random.range(30, 200) * 1000;
+    synthetic.record(FramePhase::Render, us);
+  }
+  synthetic.frameEnd(false);
+  std::sort(samples.begin(), samples.end());
+  uint32_t exact = samples[samples.size() - samples.size() / 100 - 1];
+  uint32_t estimate = synthetic.summary(FramePhase::Render).p99Us;
+  std::cout << "p99 exact:    " << exact << " us    histogram:    " << estimate << " us" << std::endl;
+  if (estimate < exact || estimate > exact + exact / 4)
+  {
+    std::cout << "p99 estimate out of range!" << std::endl;
+  }
+  synthetic.printCsv(std::cout);
+  std::cout << std::endl;
+}
+
+static size_t serialBytes = 0;
+static int serialWrites = 0;
+
+static void countSerial(const char* /* data */, int len)
+{
+  serialBytes += (size_t)len;
+  ++serialWrites;
+}
+
+// A dump of MAX_BUFFER_LENGTH LEDs through the console ring at the firmware's
+// per-frame budget: total bytes, frames it takes, the most sent in one frame
+// and the number of writes to the link (the old dump flushed every line)
+static void benchSerial()
+{
+  std::cout << "== serial ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "dump"
+            << std::setw(12) << "bytes"
+            << std::setw(12) << "frames"
+            << std::setw(16) << "max bytes/frame"
+            << std::setw(12) << "writes"
+            << std::setw(12) << "stalls" << std::endl;
+
+  const size_t budget = 2048;
+  LEDBuffer buffer(MAX_BUFFER_LENGTH);
+  fillHueRamp(buffer, 0, (uint32_t)(0x100000000ull / buffer.size()));
+  for (bool hex : {false, true})
+  {
+    SerialTx tx(countSerial);
+    std::ostream out(&tx);
+    BufferDump dump;
+    serialBytes = 0;
+    serialWrites = 0;
+    int frames = 0;
+    size_t maxSent = 0;
+    dump.start(hex);
+    while (dump.active() || tx.used() > 0)
+    {
+      dump.pump(buffer, out, tx.space());
+      maxSent = std::max(maxSent, tx.pump(budget));
+      ++frames;
+    }
+    std::cout << std::left << std::setw(18) << (hex ? "dumphex" : "dump")
+              << std::setw(12) << serialBytes
+              << std::setw(12) << frames
+              << std::setw(16) << maxSent
+              << std::setw(12) << serialWrites
+              << std::setw(12) << tx.stalls() << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+using SettingsJournal = FlashJournal<Settings, SimFlash>;
+
+// Settings that differ in one field per save
+static Settings journalValue(int i)
+{
+  Settings settings;
+  std::memset(&settings, 0, sizeof(settings));
+  settings.setDefaults();
+  settings.param = (float)i;
+  return settings;
+}
+
+static bool loadsAs(SimFlash& flash, int value)
+{
+  SettingsJournal journal(flash);
+  Settings loaded;
+  if (!journal.load(loaded)) return value < 0;
+  Settings expected = journalValue(value);
+  return value >= 0 && std::memcmp(&loaded, &expected, sizeof(Settings)) == 0;
+}
+
+// Settings journal on simulated flash. Wear: erases per sector after many
+// saves, against rewriting one sector each time as FlashStorage did. Replay:
+// the boot-time scan of a full journal. Power loss: for every history length
+// over a few wraps of a small journal, cut the power at each flash operation
+// of the next save; the reload must give the old or new settings, never
+// anything else, and the save after it must land.
+static void benchJournal()
+{
+  std::cout << "== journal ==" << std::endl;
+  std::cout << "record " << SettingsJournal::RecordSize << " bytes, "
+            << SimFlash::SectorSize / SettingsJournal::RecordSize << " per sector" << std::endl;
+  std::cout << std::left << std::setw(18) << "store"
+            << std::setw(12) << "saves"
+            << std::setw(12) << "erases"
+            << std::setw(16) << "max/sector"
+            << std::setw(16) << "min/sector"
+            << std::setw(12) << "saves/erase" << std::endl;
+
+  const int saves = 10000;
+  for (uint32_t sectors : {1u, 8u})
+  {
+    SimFlash flash(sectors);
+    uint32_t erases = 0;
+    if (sectors == 1)
+    {
+      // FlashStorage: erase and rewrite the sector for every change
+      for (int i = 0; i < saves; ++i)
+      {
+        Settings settings = journalValue(i);
+        flash.erase(0);
+        for (uint32_t off = 0; off < sizeof(Settings); off += SimFlash::PageSize)
+        {
+          uint8_t page[SimFlash::PageSize];
+          std::memset(page, 0xFF, sizeof(page));
+          std::memcpy(page, (uint8_t*)&settings + off, std::min<size_t>(SimFlash::PageSize, sizeof(Settings) - off));
+          flash.program(off, page);
+        }
+      }
+      erases = flash.erases(0);
+    }
+    else
+    {
+      SettingsJournal journal(flash);
+      Settings scratch;
+      journal.load(scratch);
+      for (int i = 0; i < saves; ++i)
+      {
+        journal.save(journalValue(i));
+        journal.commit();
+      }
+      erases = journal.erases();
+    }
+    std::cout << std::left << std::setw(18) << (sectors == 1 ? "single sector" : "journal 8 sect")
+              << std::setw(12) << saves
+              << std::setw(12) << erases
+              << std::setw(16) << flash.maxErases()
+              << std::setw(16) << flash.minErases()
+              << std::setw(12) << std::fixed << std::setprecision(1) << (double)saves / erases << std::endl;
+
+    if (sectors > 1)
+    {
+      Settings loaded;
+      const int loads = 200;
+      auto start = BenchClock::now();
+      for (int i = 0; i < loads; ++i)
+      {
+        SettingsJournal journal(flash);
+        journal.load(loaded);
+      }
+      std::cout << "replay of " << sectors << " full sectors: " << std::setprecision(1)
+                << secondsSince(start) * 1e6 / loads << " us (host)" << std::endl;
+      if (!loadsAs(flash, saves - 1)) std::cout << "replay loaded the wrong record!" << std::endl;
+    }
+  }
+
+  const uint32_t sectors = 3;
+  const int perSector = SimFlash::SectorSize / SettingsJournal::RecordSize;
+  const int maxOps = SettingsJournal::RecordPages + 1;
+  int runs = 0, kept = 0, landed = 0, lost = 0, stuck = 0;
+  for (int history = 0; history <= (int)sectors * perSector * 2 + 1; ++history)
+  {
+    SimFlash base(sectors);
+    {
+      SettingsJournal journal(base);
+      Settings scratch;
+      journal.load(scratch);
+      for (int i = 0; i < history; ++i)
+      {
+        journal.save(journalValue(i));
+        journal.commit();
+      }
+    }
+    for (int kill = 1; kill <= maxOps; ++kill)
+    {
+      SimFlash flash = base;
+      {
+        SettingsJournal journal(flash);
+        Settings scratch;
+        journal.load(scratch);
+        journal.save(journalValue(history));
+        flash.cutPowerAfter(kill);
+        journal.commit();
+      }
+      bool cutShort = !flash.powered();
+      flash.powerOn();
+      ++runs;
+      if (loadsAs(flash, history))
+        ++landed;
+      else if (cutShort && loadsAs(flash, history - 1))
+        ++kept;
+      else
+        ++lost;
+
+      // Power back on: the next save must work around whatever was torn
+      SettingsJournal journal(flash);
+      Settings scratch;
+      journal.load(scratch);
+      journal.save(journalValue(history + 1));
+      journal.commit();
+      if (!loadsAs(flash, history + 1)) ++stuck;
+    }
+  }
+  std::cout << "power cuts: " << runs << " runs, " << kept << " kept old, " << landed << " landed new, "
+            << lost << " lost, " << stuck << " failed the next save" << std::endl;
+  std::cout << std::endl;
+}
+
+// Switching between two looks on 8 chains of 1250 LEDs that differ in scene,
+// param, brightness and every chain's calibration: one command per field with
+// a frame going out after each (as when an operator types them), the preset
+// fields applied with the tables built at the old brightness and then again
+// on the next transmit, and a preset load
+static void benchPreset()
+{
+  std::cout << "== preset ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "switch"
+            << std::setw(12) << "us"
+            << std::setw(12) << "frames" << std::endl;
+
+  Settings settings;
+  settings.setDefaults();
+  for (int i = 0; i < MaxChains; ++i)
+  {
+    settings.chains[i].count = MAX_BUFFER_LENGTH / MaxChains;
+    settings.chains[i].offset = i * (MAX_BUFFER_LENGTH / MaxChains);
+  }
+  LEDBuffer drawBuffer;
+  LedOutput<MockWs2812bChain> output(settings.chainPins());
+  settings.updateMappings(output.mappings(), drawBuffer);
+  fillHueRamp(drawBuffer, 0, (uint32_t)(0x100000000ull / drawBuffer.size()));
+
+  PresetBank bank;
+  bank.clear();
+  Settings look = settings;
+  for (int p = 0; p < 2; ++p)
+  {
+    look.scene = p;
+    look.param = 0.25f + p * 0.5f;
+    look.brightness = 0.4f + p * 0.3f;
+    for (int i = 0; i < MaxChains; ++i)
+    {
+      look.chains[i].colorBalance = {1.0f, 0.9f - p * 0.1f, 0.8f};
+      look.chains[i].gamma = 2.0f + p * 0.4f;
+    }
+    bank.presets[p].capture(p ? "b" : "a", look, true);
+  }
+
+  const int switches = 20;
+  for (int mode = 0; mode < 3; ++mode)
+  {
+    bank.presets[1].apply(settings);
+    settings.updateCalibrations(output);
+    output.write(drawBuffer, settings.brightness);
+    int frames = 0;
+    auto start = BenchClock::now();
+    for (int n = 0; n < switches; ++n)
+    {
+      const Preset& preset = bank.presets[n & 1 ? 1 : 0];
+      if (mode == 0)
+      {
+        auto command = [&]()
+        {
+          output.write(drawBuffer, settings.brightness);
+          ++frames;
+        };
+        settings.scene = preset.scene; command();
+        settings.param = preset.param; command();
+        settings.brightness = preset.brightness; command();
+        for (int i = 0; i < MaxChains; ++i)
+        {
+          settings.chains[i].colorBalance = preset.chains[i].colorBalance;
+          settings.updateCalibrations(output); command();
+          settings.chains[i].gamma = preset.chains[i].gamma;
+          settings.updateCalibrations(output); command();
+        }
+      }
+      else
+      {
+        preset.apply(settings);
+        if (mode == 1)
+        {
+          for (int i = 0; i < MaxChains; ++i)
+          {
+            const ChainSettings& chain = settings.chains[i];
+            output.calibration(i, chain.colorBalance, chain.gamma, chain.ditherBits);
+          }
+        }
+        else
+        {
+          settings.updateCalibrations(output);
+        }
+        output.write(drawBuffer, settings.brightness);
+        ++frames;
+      }
+    }
+    static const char* const names[] = {"commands", "preset, 2 builds", "preset"};
+    std::cout << std::left << std::setw(18) << names[mode]
+              << std::setw(12) << std::fixed << std::setprecision(0) << secondsSince(start) * 1e6 / switches
+              << std::setw(12) << std::setprecision(1) << (double)frames / switches << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+// Exact draw of what a mock chain last sent, from the words on the wire
+static float wireMilliamps(const MockWs2812bChain& chain, float channelMa, float idleMa)
+{
+  uint64_t sum = 0;
+  for (uint32_t w : chain.wire())
+  {
+    sum += (w >> 24) + ((w >> 16) & 0xFF) + ((w >> 8) & 0xFF);
+  }
+  return idleMa * chain.wire().size() + channelMa * (float)sum / 255.0f;
+}
+
+// The current limiter on WarmWhite at full brightness, 4 chains of 2500 LEDs
+// with a 40 A supply split evenly: the estimate and scale over the first
+// frames, then the estimate checked against the words sent after a run of
+// partial updates (the encode keeps a running total rather than resumming)
+static void benchPower()
+{
+  std::cout << "== power ==" << std::endl;
+  const int chains = 4;
+  const float budget = 10000.0f;
+  Settings settings;
+  settings.setDefaults();
+  for (int i = 0; i < chains; ++i)
+  {
+    settings.chains[i].count = MAX_BUFFER_LENGTH / chains;
+    settings.chains[i].offset = i * (MAX_BUFFER_LENGTH / chains);
+    settings.powerBudget[i] = budget;
+  }
+  LEDBuffer drawBuffer;
+  LedOutput<MockWs2812bChain> output(settings.chainPins());
+  settings.updateMappings(output.mappings(), drawBuffer);
+  settings.updateCalibrations(output);
+  settings.updatePower(output);
+
+  WarmWhite scene;
+  scene.update(drawBuffer, BenchFrameTimeSec, 1.0f);
+  std::cout << std::left << std::setw(8) << "frame"
+            << std::setw(16) << "chain0 mA"
+            << std::setw(12) << "scale"
+            << std::setw(16) << "total mA" << std::endl;
+  for (int frame = 0; frame < 12; ++frame)
+  {
+    output.write(drawBuffer, 1.0f);
+    float total = 0.0f;
+    for (int i = 0; i < chains; ++i) total += output.milliamps(i);
+    std::cout << std::left << std::setw(8) << frame
+              << std::setw(16) << std::fixed << std::setprecision(0) << output.milliamps(0)
+              << std::setw(12) << std::setprecision(3) << output.powerScale(0)
+              << std::setw(16) << std::setprecision(0) << total << std::endl;
+  }
+
+  // Random pokes, each sent as a partial update
+  Random random(1234);
+  float worstError = 0.0f;
+  for (int n = 0; n < 500; ++n)
+  {
+    int led = random.range(0, (int)drawBuffer.size() - 1);
+    drawBuffer[led] = {(uint8_t)random.range(0, 255), (uint8_t)random.range(0, 255), (uint8_t)random.range(0, 255)};
+    DirtyRange dirty;
+    dirty.mark(led, led + 1);
+    output.beginWrite(drawBuffer, 1.0f, dirty);
+    for (int i = 0; i < chains; ++i)
+    {
+      float exact = wireMilliamps(output.chain(i), settings.channelMilliamps, settings.idleMilliamps);
+      worstError = std::max(worstError, std::abs(exact - output.milliamps(i)));
+    }
+  }
+  std::cout << "worst estimate error after partial updates: " << std::setprecision(3) << worstError << " mA" << std::endl;
+  std::cout << std::endl;
+}
+
+// Clips for the animation bench: every LED moving, a few comets over a still
+// background, and random twinkles
+static void drawClip(int clip, LEDBuffer& frame, int index, Random& random)
+{
+  const int n = (int)frame.size();
+  if (clip == 0)
+  {
+    fillHueRamp(frame, (uint32_t)index << 26, (uint32_t)(0x100000000ull / n));
+  }
+  else if (clip == 1)
+  {
+    std::fill(frame.begin(), frame.end(), RGBColor{0, 0, 8});
+    for (int c = 0; c < 6; ++c)
+    {
+      int head = (index * (2 + c) + c * n / 6) % n;
+      for (int t = 0; t < 24 && t <= head; ++t)
+      {
+        frame[head - t] = RGBColor{(uint8_t)(255 - t * 10), (uint8_t)(128 - t * 5), 0};
+      }
+    }
+  }
+  else
+  {
+    if (index == 0) std::fill(frame.begin(), frame.end(), RGBColor{10, 10, 10});
+    for (int i = 0; i < n / 50; ++i)
+    {
+      frame[random.range(0, n - 1)] = RGBColor{(uint8_t)random.range(0, 255), (uint8_t)random.range(0, 255), 200};
+    }
+  }
+}
+
+// Animation images at MAX_BUFFER_LENGTH LEDs and 20 fps: size per frame, how
+// many seconds fit in the device's animation region, decode cost per LED and
+// the frame rate that leaves on the host. Also checks that frames decode back
+// exactly, in order and after a seek through the FlashAnimation scene, and
+// that an upload through the stream protocol lands in (simulated) flash and a
+// corrupted one doesn't.
+static void benchAnim()
+{
+  std::cout << "== anim ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "clip"
+            << std::setw(16) << "ns/led"
+            << std::setw(16) << "cycles/led"
+            << std::setw(14) << "bytes/frame"
+            << std::setw(14) << "seconds"
+            << std::setw(12) << "fps" << std::endl;
+
+  // The firmware's region: 1 MiB up to the 12 journal sectors and the
+  // settings sector at the end of a 2 MiB part
+  const uint32_t regionBytes = 1024 * 1024 - 13 * SimFlash::SectorSize;
+  const uint16_t fps = 20;
+  const int frames = 100;
+  static const char* const names[] = {"rainbow", "comets", "twinkle"};
+  std::vector<uint8_t> uploadBytes;
+  for (int clip = 0; clip < 3; ++clip)
+  {
+    Random random(99);
+    AnimationEncoder encoder(MAX_BUFFER_LENGTH, fps, fps * 2);
+    std::vector<LEDBuffer> source;
+    LEDBuffer frame(MAX_BUFFER_LENGTH);
+    for (int i = 0; i < frames; ++i)
+    {
+      drawClip(clip, frame, i, random);
+      encoder.addFrame(frame);
+      source.push_back(frame);
+    }
+    std::vector<uint8_t> bytes = encoder.image();
+    AnimationImage image(bytes.data(), (uint32_t)bytes.size());
+
+    LEDBuffer buffer(MAX_BUFFER_LENGTH);
+    bool exact = true;
+    for (int i = 0; i < frames; ++i)
+    {
+      exact &= image.decode(i, buffer.data(), (uint32_t)buffer.size()) && sameBuffer(buffer, source[i]);
+    }
+
+    // Frames in order, looping back to the first keyframe as playback does
+    const int iterations = 500;
+    auto start = BenchClock::now();
+    uint64_t startCycles = cycleCount();
+    for (int i = 0; i < iterations; ++i)
+    {
+      image.decode(i % frames, buffer.data(), (uint32_t)buffer.size());
+    }
+    uint64_t cycles = cycleCount() - startCycles;
+    double frameSec = secondsSince(start) / iterations;
+    double leds = (double)iterations * buffer.size();
+    double perFrame = (double)bytes.size() / frames;
+    std::cout << std::left << std::setw(18) << names[clip]
+              << std::fixed << std::setprecision(2)
+              << std::setw(16) << frameSec * 1e9 / buffer.size();
+    if (HAVE_CYCLE_COUNT)
+      std::cout << std::setw(16) << (double)cycles / leds;
+    else
+      std::cout << std::setw(16) << "n/a";
+    std::cout << std::setw(14) << std::setprecision(0) << perFrame
+              << std::setw(14) << std::setprecision(1) << regionBytes / perFrame / fps
+              << std::setw(12) << std::setprecision(0) << 1.0 / frameSec << std::endl;
+
+    // Play through the scene with a seek (invalidate) two thirds in
+    FlashAnimation::Source = bytes.data();
+    FlashAnimation::SourceSize = (uint32_t)bytes.size();
+    FlashAnimation scene;
+    for (int i = 0; i < frames; ++i)
+    {
+      if (i == frames * 2 / 3) scene.invalidate();
+      scene.update(buffer, i == 0 ? 0.0f : 1.0f / fps + 1e-6f, 0.0f);
+      exact &= sameBuffer(buffer, source[i]);
+    }
+    FlashAnimation::Source = nullptr;
+    FlashAnimation::SourceSize = 0;
+    if (!exact) std::cout << names[clip] << " decoded wrong!" << std::endl;
+
+    if (clip == 1) uploadBytes = bytes;
+  }
+
+  // The comets clip through the stream protocol into simulated flash
+  for (bool corrupt : {false, true})
+  {
+    std::vector<uint8_t> packets;
+    StreamEncoder sender;
+    sender.encodeUpload(uploadBytes, packets);
+    if (corrupt) packets[packets.size() / 2] ^= 1;
+    SimFlash flash(regionBytes / SimFlash::SectorSize);
+    AnimationWriter<SimFlash> writer(flash);
+    StreamDecoder decoder;
+    LEDBuffer unused;
+    bool ok = false;
+    for (size_t pos = 0; pos < packets.size();)
+    {
+      StreamDecoder::Event event;
+      pos += decoder.feed(packets.data() + pos, std::min<size_t>(512, packets.size() - pos), unused, event);
+      if (event == StreamDecoder::Event::UploadBegin) writer.begin(decoder.uploadValue());
+      if (event == StreamDecoder::Event::UploadData) writer.write(decoder.uploadData(), decoder.uploadBytes());
+      if (event == StreamDecoder::Event::UploadEnd) ok = writer.end(decoder.uploadValue());
+    }
+    bool stored = AnimationImage(flash.read(0), flash.size()).valid() &&
+                  std::memcmp(flash.read(0), uploadBytes.data(), uploadBytes.size()) == 0;
+    std::cout << (corrupt ? "corrupted upload: " : "upload: ") << (ok ? "ok" : "failed") << ", "
+              << (AnimationImage(flash.read(0), flash.size()).valid() ? "image in flash" : "no image")
+              << ((ok == stored) ? "" : " (mismatch!)") << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+// A kick on every beat (a thump falling from 120 to 50 Hz), a burst of hi-hat
+// noise halfway between, and a little background noise, scaled by gain. With
+// bassLine a held bass note under it too, changing every bar.
+static std::vector<int16_t> drumLoop(uint32_t rate, float bpm, float seconds, float gain, bool bassLine, Random& random)
+{
+  static const float notes[] = {55.0f, 73.4f, 82.4f, 65.4f};
+  float bassPhase = 0.0f;
+  std::vector<int16_t> samples((size_t)(rate * seconds));
+  const float beat = 60.0f / bpm;
+  float phase = 0.0f;
+  for (size_t i = 0; i < samples.size(); ++i)
+  {
+    float t = (float)i / rate;
+    float sinceBeat = std::fmod(t, beat);
+    float sinceHat = std::fmod(t + beat / 2, beat);
+    phase += 6.2831853f * (50.0f + 70.0f * std::exp(-sinceBeat / 0.03f)) / rate;
+    float kick = std::sin(phase) * std::exp(-sinceBeat / 0.12f);
+    float hat = (random.range(-1000, 1000) / 1000.0f) * 0.3f * std::exp(-sinceHat / 0.02f);
+    float noise = (random.range(-1000, 1000) / 1000.0f) * 0.02f;
+    bassPhase += 6.2831853f * notes[(int)(t / (beat * 4)) % 4] / rate;
+    float bass = bassLine ? std::sin(bassPhase) * 0.3f : 0.0f;
+    samples[i] = (int16_t)std::lround(std::max(-1.0f, std::min(1.0f, (kick * 0.6f + bass + hat + noise) * gain)) * 32767.0f);
+  }
+  return samples;
+}
+
+// Signal to error of the Q15 FFT against a double DFT of the same block, in dB
+static double fftSnr(const FixedFft<AudioAnalyzer::Log2BlockSize>& fft, const int16_t* input)
+{
+  const int n = AudioAnalyzer::BlockSize;
+  int16_t re[n], im[n];
+  std::copy(input, input + n, re);
+  std::fill(im, im + n, 0);
+  fft.transform(re, im);
+  double signal = 0.0, error = 0.0;
+  for (int k = 0; k < n / 2; ++k)
+  {
+    double er = 0.0, ei = 0.0;
+    for (int i = 0; i < n; ++i)
+    {
+      er += input[i] * std::cos(6.283185307179586 * k * i / n) / n;
+      ei -= input[i] * std::sin(6.283185307179586 * k * i / n) / n;
+    }
+    signal += er * er + ei * ei;
+    error += (re[k] - er) * (re[k] - er) + (im[k] - ei) * (im[k] - ei);
+  }
+  return 10.0 * std::log10(signal / std::max(error, 1e-12));
+}
+
+// The audio analysis: the Q15 FFT's accuracy at a few input levels, with and
+// without the analyzer's per-block scaling, the time per block for the FFT
+// and the whole analysis, whether tones land in their band, and beats found
+// in drum loops that go through a WAV file and down to the device's sample
+// rate, loud and 30 dB down, along with any found in plain noise.
+static void benchAudio()
+{
+  std::cout << "== audio ==" << std::endl;
+  const int n = AudioAnalyzer::BlockSize;
+  const float rate = AudioAnalyzer::DeviceSampleRate;
+  AudioAnalyzer analyzer(rate);
+
+  std::cout << std::left << std::setw(18) << "tone dBFS" << std::setw(16) << "fft snr dB" << std::setw(16) << "scaled snr dB" << std::endl;
+  for (int db : {0, -20, -40, -60})
+  {
+    float amplitude = 32000.0f * std::pow(10.0f, db / 20.0f);
+    int16_t block[n], scaled[n];
+    int peak = 0;
+    for (int i = 0; i < n; ++i)
+    {
+      block[i] = (int16_t)std::lround(amplitude * std::sin(6.2831853f * 10.3f * i / n));
+      peak = std::max(peak, std::abs((int)block[i]));
+    }
+    int shift = 0;
+    while (peak > 0 && (peak << (shift + 1)) <= 32767) ++shift;
+    for (int i = 0; i < n; ++i) scaled[i] = (int16_t)(block[i] << shift);
+    std::cout << std::setw(18) << db << std::setw(16) << std::setprecision(3) << fftSnr(analyzer.fft(), block)
+              << std::setw(16) << fftSnr(analyzer.fft(), scaled) << std::endl;
+  }
+
+  // Timing on noise, so every bin has something in it
+  Random random(7);
+  std::vector<int16_t> noise(n * 64);
+  for (int16_t& s : noise) s = (int16_t)random.range(-8000, 8000);
+  int16_t re[n], im[n];
+  const int iterations = 20000;
+  auto start = BenchClock::now();
+  uint64_t startCycles = cycleCount();
+  for (int i = 0; i < iterations; ++i)
+  {
+    std::copy(noise.begin() + (i % 64) * n, noise.begin() + (i % 64 + 1) * n, re);
+    std::fill(im, im + n, 0);
+    analyzer.fft().transform(re, im);
+  }
+  double fftNs = secondsSince(start) * 1e9 / iterations;
+  uint64_t fftCycles = (cycleCount() - startCycles) / iterations;
+  start = BenchClock::now();
+  startCycles = cycleCount();
+  for (int i = 0; i < iterations; ++i)
+  {
+    analyzer.process(&noise[(i % 64) * n]);
+  }
+  double processNs = secondsSince(start) * 1e9 / iterations;
+  uint64_t processCycles = (cycleCount() - startCycles) / iterations;
+  std::cout << n << "-point fft: " << std::setprecision(4) << fftNs << " ns (" << fftCycles << " cycles) per block, "
+            << "whole analysis: " << processNs << " ns (" << processCycles << " cycles), "
+            << "one block is " << n * 1000.0f / rate << " ms of audio" << std::endl;
+
+  // A tone in the middle of each band should put the most power in it
+  int inBand = 0;
+  for (int b = 0; b < AudioFeatures::Bands; ++b)
+  {
+    float hz = std::sqrt(analyzer.bandHz(b) * analyzer.bandHz(b + 1));
+    analyzer.reset();
+    int16_t block[n];
+    for (int i = 0; i < n; ++i) block[i] = (int16_t)std::lround(8000.0f * std::sin(6.2831853f * hz * i / rate));
+    analyzer.process(block);
+    const float* energies = analyzer.energies();
+    inBand += std::max_element(energies, energies + AudioFeatures::Bands) - energies == b;
+  }
+  std::cout << "tones in their own band: " << inBand << "/" << AudioFeatures::Bands << std::endl;
+
+  std::cout << std::left << std::setw(18) << "loop" << std::setw(12) << "gain" << std::setw(12) << "expected"
+            << std::setw(12) << "beats" << std::setw(12) << "bpm" << "result" << std::endl;
+  const float seconds = 20.0f;
+  struct Loop
+  {
+    const char* name;
+    float bpm;
+    bool bassLine;
+  };
+  int misses = 0;
+  static const Loop loops[] = {{"90 bpm", 90.0f, false}, {"120 bpm", 120.0f, false}, {"128 bpm", 128.0f, false},
+                               {"120 bpm + bass", 120.0f, true}, {"noise", 0.0f, false}};
+  for (const Loop& loop : loops)
+  {
+    for (float gain : {1.0f, 0.03f})
+    {
+      Random loopRandom(11);
+      std::vector<int16_t> samples = drumLoop(44100, loop.bpm > 0.0f ? loop.bpm : 60.0f, seconds, gain, loop.bassLine, loopRandom);
+      if (loop.bpm == 0.0f)
+      {
+        // Noise alone, at the level of a hi-hat
+        for (int16_t& s : samples) s = (int16_t)(loopRandom.range(-10000, 10000) * gain);
+      }
+      WavAudio audio;
+      parseWav(makeWav(samples, 44100), audio);
+      uint32_t wavRate = decimateWav(audio, AudioAnalyzer::DeviceSampleRate);
+      AudioAnalyzer loopAnalyzer((float)wavRate);
+      std::vector<float> beatTimes;
+      for (size_t at = 0; at + n <= audio.samples.size(); at += n)
+      {
+        uint32_t beats = loopAnalyzer.features().beats;
+        loopAnalyzer.process(&audio.samples[at]);
+        if (loopAnalyzer.features().beats != beats) beatTimes.push_back((float)(at + n) / wavRate);
+      }
+      float found = 0.0f;
+      if (beatTimes.size() >= 2)
+      {
+        std::vector<float> gaps;
+        for (size_t i = 1; i < beatTimes.size(); ++i) gaps.push_back(beatTimes[i] - beatTimes[i - 1]);
+        std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+        found = 60.0f / gaps[gaps.size() / 2];
+      }
+      // Within 10% of the beats in a loop, and none at all in noise
+      int expected = (int)(loop.bpm * seconds / 60.0f);
+      bool ok = std::abs((int)beatTimes.size() - expected) <= expected / 10;
+      misses += !ok;
+      std::cout << std::setw(18) << loop.name << std::setw(12) << gain << std::setw(12) << expected
+                << std::setw(12) << beatTimes.size() << std::setw(12) << std::setprecision(4) << found
+                << (ok ? "ok" : "MISS") << std::endl;
+    }
+  }
+  const int runs = (int)std::size(loops) * 2;
+  std::cout << "beats: " << runs - misses << "/" << runs << " loops ok" << (misses ? ", MISS" : "") << std::endl;
+  std::cout << std::endl;
+}
+
+// The particle scenes as they run, erasing and redrawing only the LEDs their
+// particles cover, against clearing and redrawing the whole buffer every
+// frame, checking both give the same frames
+template <typename T>
+static void benchParticleScene(uint32_t ledCount)
+{
+  const int warmup = 100;
+  const int frames = 400;
+  LEDBuffer sparseBuffer(ledCount);
+  LEDBuffer fullBuffer(ledCount);
+  T sparse;
+  T full;
+  double sparseSec = 0.0;
+  double fullSec = 0.0;
+  long particles = 0;
+  bool same = true;
+  for (int f = 0; f < warmup + frames; ++f)
+  {
+    auto start = BenchClock::now();
+    sparse.update(sparseBuffer, BenchFrameTimeSec, 0.5f);
+    double sparseFrame = secondsSince(start);
+    start = BenchClock::now();
+    full.invalidate();
+    full.update(fullBuffer, BenchFrameTimeSec, 0.5f);
+    double fullFrame = secondsSince(start);
+    same &= sameBuffer(sparseBuffer, fullBuffer);
+    if (f < warmup) continue;
+    sparseSec += sparseFrame;
+    fullSec += fullFrame;
+    particles += sparse.particles();
+  }
+  std::cout << std::left << std::setw(18) << T::Name
+            << std::setw(8) << ledCount
+            << std::setw(12) << particles / frames
+            << std::fixed << std::setprecision(2)
+            << std::setw(16) << fullSec * 1e6 / frames
+            << std::setw(16) << sparseSec * 1e6 / frames
+            << std::setprecision(1)
+            << std::setw(10) << fullSec / sparseSec
+            << (same ? "same" : "DIFFERENT") << std::endl;
+}
+
+static void benchParticles()
+{
+  std::cout << "== particles ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "scene"
+            << std::setw(8) << "leds"
+            << std::setw(12) << "particles"
+            << std::setw(16) << "full us/frame"
+            << std::setw(16) << "sparse us/frame"
+            << std::setw(10) << "speedup"
+            << "frames" << std::endl;
+  for (uint32_t ledCount : {300u, 2500u, (uint32_t)MAX_BUFFER_LENGTH})
+  {
+    benchParticleScene<Sparkles>(ledCount);
+    benchParticleScene<Comets>(ledCount);
+  }
+
+  // Through the render pipeline, which has to hand the renderer back the
+  // frame it drew for the erasing to line up
+  const uint32_t ledCount = 2500;
+  int scene = 0;
+  while (strcmp(SceneList::name(scene), Comets::Name) != 0) ++scene;
+  LEDBuffer drawBuffer(ledCount);
+  LEDBuffer direct(ledCount);
+  Comets comets;
+  RenderPipeline pipeline;
+  std::thread renderer([&]() { pipeline.runRenderer(); });
+  bool same = true;
+  for (int f = 0; f < 400; ++f)
+  {
+    pipeline.post({{scene}, BenchFrameTimeSec, 0.5f, ledCount, f == 0, {}});
+    pipeline.collect(drawBuffer);
+    comets.update(direct, BenchFrameTimeSec, 0.5f);
+    same &= sameBuffer(drawBuffer, direct);
+  }
+  pipeline.stop();
+  renderer.join();
+  SceneCompositor.reset();
+  std::cout << "Comets pipelined, 400 frames: " << (same ? "same" : "DIFFERENT") << std::endl;
+  std::cout << std::endl;
+}
+
+// CandyCane as it was: a divide and modulo per LED on every redraw. Kept as
+// the baseline for the pattern section.
+class DividedCandyCane : public Scene
+{
+public:
+  virtual bool update(LEDBuffer& buffer, float /* deltaTime */, float param) override
+  {
+    if (!needsRedraw(buffer, param))
+    {
+      return false;
+    }
+    int spacing = std::round(param * 20.0f) + 1.0f;
+    spacing += 1;
+    RGBColor colors[2] = {{230, 30, 0}, {86, 86, 86}};
+    for (int i = 0; i < (int)buffer.size(); ++i)
+    {
+      buffer[i] = colors[(i/spacing)%2];
+    }
+    return true;
+  }
+};
+
+// Redraws of the stripes, per-LED divide against block copies of a cached
+// period, and what a param that wanders within one stripe spacing costs
+static void benchPattern()
+{
+  std::cout << "== pattern ==" << std::endl;
+  std::cout << std::left << std::setw(18) << "candy cane"
+            << std::setw(8) << "leds"
+            << std::setw(16) << "us/redraw"
+            << "frames" << std::endl;
+
+  const int frames = 400;
+  for (uint32_t ledCount : {300u, 2500u, (uint32_t)MAX_BUFFER_LENGTH})
+  {
+    LEDBuffer dividedBuffer(ledCount);
+    LEDBuffer copiedBuffer(ledCount);
+    DividedCandyCane divided;
+    CandyCane copied;
+    bool same = true;
+    double dividedSec = 0.0;
+    double copiedSec = 0.0;
+    for (int f = 0; f < frames; ++f)
+    {
+      // A new spacing every frame, so every frame redraws
+      float param = (f % 21) / 20.0f;
+      auto start = BenchClock::now();
+      divided.update(dividedBuffer, BenchFrameTimeSec, param);
+      dividedSec += secondsSince(start);
+      start = BenchClock::now();
+      copied.update(copiedBuffer, BenchFrameTimeSec, param);
+      copiedSec += secondsSince(start);
+      same &= sameBuffer(dividedBuffer, copiedBuffer);
+    }
+    std::cout << std::left << std::setw(18) << "divide"
+              << std::setw(8) << ledCount
+              << std::fixed << std::setprecision(2)
+              << std::setw(16) << dividedSec * 1e6 / frames << std::endl;
+    std::cout << std::left << std::setw(18) << "block copies"
+              << std::setw(8) << ledCount
+              << std::setw(16) << copiedSec * 1e6 / frames
+              << (same ? "same" : "DIFFERENT") << std::endl;
+  }
+
+  // param drifting by less than a stripe step, as a pot's noise does
+  LEDBuffer buffer(MAX_BUFFER_LENGTH);
+  DividedCandyCane divided;
+  CandyCane copied;
+  int dividedRedraws = 0;
+  int copiedRedraws = 0;
+  for (int f = 0; f < frames; ++f)
+  {
+    float param = 0.5f + 0.01f * std::sin(f * 0.3f);
+    dividedRedraws += divided.update(buffer, BenchFrameTimeSec, param);
+    copiedRedraws += copied.update(buffer, BenchFrameTimeSec, param);
+  }
+  std::cout << "param noise, " << frames << " frames: " << dividedRedraws << " redraws keyed on param, "
+            << copiedRedraws << " keyed on spacing" << std::endl;
+
+  // Switching between the pattern scenes, as the buttons do
+  uint32_t hits = PatternScene::Cache.hits();
+  uint32_t misses = PatternScene::Cache.misses();
+  const int patterns[] = {0, 3, 4, 5};
+  auto start = BenchClock::now();
+  for (int f = 0; f < frames; ++f)
+  {
+    Scenes.activate(patterns[f % 4]).update(buffer, BenchFrameTimeSec, 0.5f);
+  }
+  double switchSec = secondsSince(start);
+  Scenes.deactivate();
+  std::cout << "switching scenes at " << MAX_BUFFER_LENGTH << " LEDs: " << std::fixed << std::setprecision(2)
+            << switchSec * 1e6 / frames << " us/frame, cache " << PatternScene::Cache.hits() - hits << " hits "
+            << PatternScene::Cache.misses() - misses << " misses" << std::endl;
+  std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  auto enabled = [&](const char* section)
+  {
+    if (argc < 2) return true;
+    for (int i = 1; i < argc; ++i)
+    {
+      if (strcmp(argv[i], section) == 0) return true;
+    }
+    return false;
+  };
+
+  if (enabled("scenes")) benchScenes();
+  if (enabled("registry")) benchRegistry();
+  if (enabled("idle")) benchIdle();
+  if (enabled("layout")) benchLayout();
+  if (enabled("hue")) benchHue();
+  if (enabled("pipeline")) benchPipeline();
+  if (enabled("transmit")) benchTransmit();
+  if (enabled("overlap")) benchOverlap();
+  if (enabled("dither")) benchDither();
+  if (enabled("stream")) benchStream();
+  if (enabled("blend")) benchBlend();
+  if (enabled("spike")) benchSpike();
+  if (enabled("stats")) benchStats();
+  if (enabled("serial")) benchSerial();
+  if (enabled("journal")) benchJournal();
+  if (enabled("preset")) benchPreset();
+  if (enabled("power")) benchPower();
+  if (enabled("anim")) benchAnim();
+  if (enabled("audio")) benchAudio();
+  if (enabled("particles")) benchParticles();
+  if (enabled("pattern")) benchPattern();
+  return 0;
+}
@@ -0,0 +1,431 @@
+// Golden-image regression harness for the scenes.
+//
+// Usage: pico-led-capture record <dir> [scene...] [options]
+//          --frames <n>       frames per capture, default 150
+//          --leds <n>         draw buffer size, default 60
+//          --param <p>        scene parameter, default 0.5
+//          --dt <seconds>     time step per frame, default 0.05
+//          --layout <w> <h>   render on a serpentine w x h matrix
+//        pico-led-capture compare <dir> [--tolerance n] [--diff <dir>]
+//        pico-led-capture view <file.cap> <out.ppm>
+//
+// record runs each scene (every registered scene if none are named) from a
+// fresh activation with a fixed time step and param, and writes what it drew
+// to <dir>/<Scene>-<param%>[-<w>x<h>].cap. compare renders every capture in
+// <dir> again with the settings stored in it and checks each channel of each
+// LED against the capture, within tolerance (default 0). For each capture
+// that doesn't match it writes a PPM image, one row per frame: the capture,
+// the new output and their difference amplified 8x. It exits with 1 if any
+// capture failed.
+//
+// A capture is a short header and the frames as an animation image (see
+// Animation.hpp), so static scenes take almost nothing and the rest are
+// delta and run-length coded:
+//
+//   0   magic      "PLCP"
+//   4   version    (u16)
+//   6   width      layout width, 0 for a line (u16)
+//   8   height     (u16)
+//   10  reserved   (u16)
+//   12  deltaTime  seconds (f32)
+//   16  param      (f32)
+//   20  scene      name, NUL padded (32 bytes)
+//   52  frames     animation image
+//
+// FlashAnimation plays a fixed rainbow clip, and the audio scenes get a
+// made-up analysis that repeats exactly, so every scene draws something.
+
+#include "Animation.hpp"
+#include "AudioAnalyzer.hpp"
+#include "HueTable.hpp"
+#include "PixelMap.hpp"
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t CaptureMagic = 0x50434C50;  // "PLCP"
+static constexpr uint16_t CaptureVersion = 1;
+static constexpr size_t NameSize = 32;
+static constexpr size_t HeaderSize = 20 + NameSize;
+static constexpr int DiffGain = 8;
+// The firmware's MAX_BUFFER_LENGTH
+static constexpr uint32_t MaxLeds = 10000;
+
+struct CaptureSettings
+{
+  std::string scene;
+  uint32_t leds = 60;
+  uint32_t frames = 150;
+  float deltaTime = 0.05f;
+  float param = 0.5f;
+  uint16_t width = 0;
+  uint16_t height = 0;
+};
+
+static bool readFile(const fs::path& path, std::vector<uint8_t>& bytes)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+  uint8_t chunk[65536];
+  size_t n;
+  bytes.clear();
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) bytes.insert(bytes.end(), chunk, chunk + n);
+  fclose(file);
+  return true;
+}
+
+static bool writeFile(const fs::path& path, const std::vector<uint8_t>& bytes)
+{
+  FILE* file = fopen(path.c_str(), "wb");
+  bool ok = file && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+  if (file) fclose(file);
+  return ok;
+}
+
+static int sceneIndex(const std::string& name)
+{
+  for (int i = 0; i < SceneList::size(); ++i)
+  {
+    if (name == SceneList::name(i)) return i;
+  }
+  return -1;
+}
+
+// The audio scenes' input for a frame: bands swelling at different rates and
+// a beat every 12 frames
+static AudioFeatures syntheticAudio(uint32_t frame)
+{
+  AudioFeatures features;
+  for (int b = 0; b < AudioFeatures::Bands; ++b)
+  {
+    features.bands[b] = 0.5f + 0.5f * std::sin(frame * (0.1f + 0.05f * b));
+  }
+  features.level = 0.5f + 0.5f * std::sin(frame * 0.07f);
+  features.beats = frame / 12;
+  features.beat = 1.0f - (frame % 12) / 12.0f;
+  return features;
+}
+
+// A rainbow moving along the LEDs for FlashAnimation to play
+static std::vector<uint8_t> rainbowClip(uint32_t leds)
+{
+  AnimationEncoder encoder(leds, 20, 40);
+  LEDBuffer frame(leds);
+  for (int i = 0; i < 60; ++i)
+  {
+    fillHueRamp(frame, (uint32_t)i << 26, (uint32_t)(0x100000000ull / leds));
+    encoder.addFrame(frame);
+  }
+  return encoder.image();
+}
+
+// Run a scene from a fresh activation, calling out with each frame it shows
+static void render(const CaptureSettings& settings, int scene, const std::function<void(uint32_t, const LEDBuffer&)>& out)
+{
+  std::vector<uint8_t> clip = rainbowClip(settings.leds);
+  FlashAnimation::Source = clip.data();
+  FlashAnimation::SourceSize = (uint32_t)clip.size();
+
+  PixelMap map;
+  if (settings.width == 0 || !map.matrix((int)settings.leds, settings.width, settings.height, true))
+  {
+    map.line((int)settings.leds);
+  }
+  SceneList table;
+  table.layout(&map);
+  Scene& active = table.activate(scene);
+
+  LEDBuffer buffer(settings.leds, RGBColor{0, 0, 0});
+  for (uint32_t f = 0; f < settings.frames; ++f)
+  {
+    AudioScene::Input = syntheticAudio(f);
+    // A frame the scene skipped shows the last one again
+    active.update(buffer, settings.deltaTime, settings.param);
+    out(f, buffer);
+  }
+  table.deactivate();
+  FlashAnimation::Source = nullptr;
+  FlashAnimation::SourceSize = 0;
+}
+
+static std::vector<uint8_t> encodeCapture(const CaptureSettings& settings, const std::vector<uint8_t>& image)
+{
+  std::vector<uint8_t> bytes(HeaderSize, 0);
+  auto put = [&](size_t at, const void* value, size_t size) { memcpy(&bytes[at], value, size); };
+  put(0, &CaptureMagic, 4);
+  put(4, &CaptureVersion, 2);
+  put(6, &settings.width, 2);
+  put(8, &settings.height, 2);
+  put(12, &settings.deltaTime, 4);
+  put(16, &settings.param, 4);
+  memcpy(&bytes[20], settings.scene.c_str(), std::min(settings.scene.size(), NameSize - 1));
+  bytes.insert(bytes.end(), image.begin(), image.end());
+  return bytes;
+}
+
+static bool decodeCapture(const std::vector<uint8_t>& bytes, CaptureSettings& settings, AnimationImage& image)
+{
+  if (bytes.size() < HeaderSize) return false;
+  uint32_t magic;
+  uint16_t version;
+  memcpy(&magic, &bytes[0], 4);
+  memcpy(&version, &bytes[4], 2);
+  if (magic != CaptureMagic || version != CaptureVersion) return false;
+  memcpy(&settings.width, &bytes[6], 2);
+  memcpy(&settings.height, &bytes[8], 2);
+  memcpy(&settings.deltaTime, &bytes[12], 4);
+  memcpy(&settings.param, &bytes[16], 4);
+  settings.scene.assign((const char*)&bytes[20], strnlen((const char*)&bytes[20], NameSize));
+  image = AnimationImage(bytes.data() + HeaderSize, (uint32_t)(bytes.size() - HeaderSize));
+  if (!image.valid()) return false;
+  settings.leds = image.leds();
+  settings.frames = image.frames();
+  return true;
+}
+
+// Binary PPM, rows top to bottom
+static bool writePpm(const fs::path& path, int width, int height, const std::vector<uint8_t>& rgb)
+{
+  std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+  std::vector<uint8_t> bytes(header.begin(), header.end());
+  bytes.insert(bytes.end(), rgb.begin(), rgb.end());
+  return writeFile(path, bytes);
+}
+
+static void putPixel(std::vector<uint8_t>& rgb, size_t at, const RGBColor& c)
+{
+  rgb[at * 3] = c.R;
+  rgb[at * 3 + 1] = c.G;
+  rgb[at * 3 + 2] = c.B;
+}
+
+static std::string captureName(const CaptureSettings& settings)
+{
+  std::string name = settings.scene + "-" + std::to_string((int)std::lround(settings.param * 100.0f));
+  if (settings.width > 0) name += "-" + std::to_string(settings.width) + "x" + std::to_string(settings.height);
+  return name + ".cap";
+}
+
+static int record(const fs::path& dir, const std::vector<std::string>& scenes, CaptureSettings settings)
+{
+  fs::create_directories(dir);
+  std::vector<std::string> names = scenes;
+  if (names.empty())
+  {
+    for (int i = 0; i < SceneList::size(); ++i) names.push_back(SceneList::name(i));
+  }
+  for (const std::string& name : names)
+  {
+    int scene = sceneIndex(name);
+    if (scene < 0)
+    {
+      std::cerr << "unknown scene " << name << std::endl;
+      return 1;
+    }
+    settings.scene = name;
+    uint16_t fps = (uint16_t)std::max(1L, std::lround(1.0f / settings.deltaTime));
+    AnimationEncoder encoder(settings.leds, fps, fps * 2);
+    render(settings, scene, [&](uint32_t, const LEDBuffer& frame) { encoder.addFrame(frame); });
+    std::vector<uint8_t> bytes = encodeCapture(settings, encoder.image());
+    fs::path path = dir / captureName(settings);
+    if (!writeFile(path, bytes))
+    {
+      perror(path.c_str());
+      return 1;
+    }
+    std::cout << path.string() << ": " << settings.frames << " frames of " << settings.leds << " LEDs, "
+              << bytes.size() << " bytes" << std::endl;
+  }
+  return 0;
+}
+
+static int compare(const fs::path& dir, int tolerance, const fs::path& diffDir)
+{
+  std::vector<fs::path> captures;
+  for (const fs::directory_entry& entry : fs::directory_iterator(dir))
+  {
+    if (entry.path().extension() == ".cap") captures.push_back(entry.path());
+  }
+  std::sort(captures.begin(), captures.end());
+  if (captures.empty())
+  {
+    std::cerr << "no captures in " << dir.string() << std::endl;
+    return 1;
+  }
+
+  int failed = 0;
+  for (const fs::path& path : captures)
+  {
+    std::vector<uint8_t> bytes;
+    CaptureSettings settings;
+    AnimationImage image;
+    if (!readFile(path, bytes) || !decodeCapture(bytes, settings, image))
+    {
+      std::cout << path.filename().string() << ": FAIL, not a capture" << std::endl;
+      ++failed;
+      continue;
+    }
+    int scene = sceneIndex(settings.scene);
+    if (scene < 0)
+    {
+      std::cout << path.filename().string() << ": FAIL, no scene " << settings.scene << std::endl;
+      ++failed;
+      continue;
+    }
+
+    // Golden, output and difference side by side, a gap between each
+    const int leds = (int)settings.leds;
+    const int width = leds * 3 + 8;
+    std::vector<uint8_t> rgb((size_t)width * settings.frames * 3, 0);
+    LEDBuffer golden(settings.leds, RGBColor{0, 0, 0});
+    uint32_t badLeds = 0;
+    int worst = 0;
+    int firstBad = -1;
+    bool corrupt = false;
+    render(settings, scene, [&](uint32_t f, const LEDBuffer& frame)
+    {
+      corrupt |= !image.decode(f, golden.data(), settings.leds);
+      size_t row = (size_t)f * width;
+      for (int i = 0; i < leds; ++i)
+      {
+        const RGBColor& g = golden[i];
+        const RGBColor& o = frame[i];
+        int dr = std::abs(g.R - o.R), dg = std::abs(g.G - o.G), db = std::abs(g.B - o.B);
+        int diff = std::max({dr, dg, db});
+        worst = std::max(worst, diff);
+        if (diff > tolerance)
+        {
+          ++badLeds;
+          if (firstBad < 0) firstBad = (int)f;
+        }
+        putPixel(rgb, row + i, g);
+        putPixel(rgb, row + leds + 4 + i, o);
+        putPixel(rgb, row + leds * 2 + 8 + i, RGBColor{(uint8_t)std::min(dr * DiffGain, 255),
+                                                       (uint8_t)std::min(dg * DiffGain, 255),
+                                                       (uint8_t)std::min(db * DiffGain, 255)});
+      }
+    });
+
+    std::cout << path.filename().string() << ": ";
+    if (corrupt)
+    {
+      std::cout << "FAIL, frames don't decode" << std::endl;
+      ++failed;
+      continue;
+    }
+    if (badLeds == 0)
+    {
+      std::cout << "ok (max diff " << worst << ")" << std::endl;
+      continue;
+    }
+    ++failed;
+    fs::path diffPath = (diffDir.empty() ? path.parent_path() : diffDir) / (path.stem().string() + ".diff.ppm");
+    if (!diffDir.empty()) fs::create_directories(diffDir);
+    writePpm(diffPath, width, (int)settings.frames, rgb);
+    std::cout << "FAIL, " << badLeds << " LED frames over tolerance " << tolerance << ", max diff " << worst
+              << ", first at frame " << firstBad << ", see " << diffPath.string() << std::endl;
+  }
+  std::cout << captures.size() - failed << "/" << captures.size() << " captures match" << std::endl;
+  return failed ? 1 : 0;
+}
+
+static int view(const fs::path& path, const fs::path& out)
+{
+  std::vector<uint8_t> bytes;
+  CaptureSettings settings;
+  AnimationImage image;
+  if (!readFile(path, bytes) || !decodeCapture(bytes, settings, image))
+  {
+    std::cerr << path.string() << ": not a capture" << std::endl;
+    return 1;
+  }
+  LEDBuffer frame(settings.leds, RGBColor{0, 0, 0});
+  std::vector<uint8_t> rgb((size_t)settings.leds * settings.frames * 3);
+  for (uint32_t f = 0; f < settings.frames; ++f)
+  {
+    if (!image.decode(f, frame.data(), settings.leds))
+    {
+      std::cerr << path.string() << ": frame " << f << " doesn't decode" << std::endl;
+      return 1;
+    }
+    for (uint32_t i = 0; i < settings.leds; ++i) putPixel(rgb, (size_t)f * settings.leds + i, frame[i]);
+  }
+  if (!writePpm(out, (int)settings.leds, (int)settings.frames, rgb))
+  {
+    perror(out.c_str());
+    return 1;
+  }
+  std::cout << settings.scene << ": " << settings.frames << " frames of " << settings.leds << " LEDs, param "
+            << settings.param << ", dt " << settings.deltaTime << std::endl;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cerr << "usage: " << argv[0] << " record <dir> [scene...] [--frames n] [--leds n] [--param p] [--dt s] [--layout w h]" << std::endl;
+    std::cerr << "       " << argv[0] << " compare <dir> [--tolerance n] [--diff <dir>]" << std::endl;
+    std::cerr << "       " << argv[0] << " view <file.cap> <out.ppm>" << std::endl;
+    return 1;
+  }
+
+  const std::string command = argv[1];
+  const fs::path path = argv[2];
+  if (command == "view" && argc == 4)
+  {
+    return view(path, argv[3]);
+  }
+
+  CaptureSettings settings;
+  std::vector<std::string> scenes;
+  int tolerance = 0;
+  fs::path diffDir;
+  for (int i = 3; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) settings.frames = (uint32_t)atol(argv[++i]);
+    else if (strcmp(argv[i], "--leds") == 0 && i + 1 < argc) settings.leds = (uint32_t)atol(argv[++i]);
+    else if (strcmp(argv[i], "--param") == 0 && i + 1 < argc) settings.param = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc) settings.deltaTime = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "--layout") == 0 && i + 2 < argc)
+    {
+      settings.width = (uint16_t)atoi(argv[++i]);
+      settings.height = (uint16_t)atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--diff") == 0 && i + 1 < argc) diffDir = argv[++i];
+    else if (argv[i][0] != '-' && command == "record") scenes.push_back(argv[i]);
+    else
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  if (command == "record")
+  {
+    if (settings.leds == 0 || settings.leds > MaxLeds || settings.frames == 0 || settings.deltaTime <= 0.0f)
+    {
+      std::cerr << "bad frame count, LED count or time step" << std::endl;
+      return 1;
+    }
+    return record(path, scenes, settings);
+  }
+  if (command == "compare")
+  {
+    return compare(path, tolerance, diffDir);
+  }
+  std::cerr << "unknown command " << command << std::endl;
+  return 1;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Host stand-in for PicoFlash, for FlashJournal. Behaves like NOR flash:
+// erase sets a sector to 0xFF and program can only clear bits, so writing
+// over data that wasn't erased corrupts it the way it would on the chip.
+//
+// Counts erases per sector to show wear, and can cut the power partway
+// through: after cutPowerAfter(n) the nth erase or program from then on only
+// gets halfway, and every operation fails until powerOn().
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class SimFlash
+{
+public:
+  static constexpr uint32_t SectorSize = 4096;
+  static constexpr uint32_t PageSize = 256;
+
+  SimFlash(uint32_t sectors) : bytes_(sectors * SectorSize, 0xFF), erases_(sectors, 0) {}
+
+  uint32_t size() const { return (uint32_t)bytes_.size(); }
+
+  const uint8_t* read(uint32_t offset) const
+  {
+    return bytes_.data() + offset;
+  }
+
+  bool erase(uint32_t offset)
+  {
+    if (!powered()) return false;
+    uint32_t length = cutting() ? SectorSize / 2 : SectorSize;
+    std::fill(bytes_.begin() + offset, bytes_.begin() + offset + length, 0xFF);
+    ++erases_[offset / SectorSize];
+    return !cut();
+  }
+
+  bool program(uint32_t offset, const uint8_t* page)
+  {
+    if (!powered()) return false;
+    uint32_t length = cutting() ? PageSize / 2 : PageSize;
+    for (uint32_t i = 0; i < length; ++i)
+    {
+      bytes_[offset + i] &= page[i];
+    }
+    return !cut();
+  }
+
+  // Tear the nth operation from now (1 is the next one) and fail the rest
+  void cutPowerAfter(uint32_t ops) { cutAfter_ = ops; }
+  void powerOn() { cutAfter_ = 0; dead_ = false; }
+  bool powered() const { return !dead_; }
+
+  uint32_t erases(uint32_t sector) const { return erases_[sector]; }
+  uint32_t maxErases() const { return *std::max_element(erases_.begin(), erases_.end()); }
+  uint32_t minErases() const { return *std::min_element(erases_.begin(), erases_.end()); }
+
+private:
+  bool cutting() const { return cutAfter_ == 1; }
+
+  // Count down an operation; true if the power went with it
+  bool cut()
+  {
+    if (cutAfter_ == 0) return false;
+    if (--cutAfter_ == 0) dead_ = true;
+    return dead_;
+  }
+
+  std::vector<uint8_t> bytes_;
+  std::vector<uint32_t> erases_;
+  uint32_t cutAfter_ = 0;
+  bool dead_ = false;
+};
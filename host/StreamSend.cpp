@@ -0,0 +1,223 @@
+// Reference sender for the binary streaming protocol (see StreamProtocol.hpp).
+//
+// Usage: pico-led-stream-send <serial-device> [options]
+//   --demo          send a moving rainbow (default)
+//   --raw <file>    send raw RGB frames (leds * 3 bytes each) from a file, - for stdin
+//   --leds <n>      frame size, defaults to the draw buffer size the device reports
+//   --fps <f>       frames per second, default 60
+//   --frames <n>    stop after n frames, default runs until EOF or Ctrl-C
+//   --upload <file> store an animation image (from pico-led-anim-encode) in
+//                   the device's flash instead of streaming frames
+//
+// Frames are delta-encoded against the previous one, so only changed ranges
+// go over the wire.
+
+#include "HueTable.hpp"
+#include "StreamProtocol.hpp"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static bool writeAll(int fd, const uint8_t* data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) return false;
+    data += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// Read lines from the device until one starts with prefix or the timeout passes
+static bool waitForLine(int fd, const std::string& prefix, std::string& line, int timeoutMs)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  line.clear();
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    char c;
+    ssize_t n = read(fd, &c, 1);
+    if (n <= 0)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    if (c == '\n')
+    {
+      if (line.compare(0, prefix.size(), prefix) == 0) return true;
+      line.clear();
+    }
+    else if (c != '\r')
+    {
+      line += c;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    std::cerr << "usage: " << argv[0] << " <serial-device> [--demo | --raw <file> | --upload <file>] [--leds n] [--fps f] [--frames n]" << std::endl;
+    return 1;
+  }
+
+  const char* device = argv[1];
+  const char* rawPath = nullptr;
+  const char* uploadPath = nullptr;
+  int leds = 0;
+  double fps = 60.0;
+  long maxFrames = -1;
+  for (int i = 2; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--demo") == 0) rawPath = nullptr;
+    else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) rawPath = argv[++i];
+    else if (strcmp(argv[i], "--upload") == 0 && i + 1 < argc) uploadPath = argv[++i];
+    else if (strcmp(argv[i], "--leds") == 0 && i + 1 < argc) leds = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) fps = atof(argv[++i]);
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) maxFrames = atol(argv[++i]);
+    else
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+  {
+    perror(device);
+    return 1;
+  }
+  termios tio {};
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  // Switch the device into stream mode; it answers with its draw buffer size
+  const char enter[] = "stream\n";
+  writeAll(fd, (const uint8_t*)enter, sizeof(enter) - 1);
+  std::string reply;
+  if (!waitForLine(fd, "streaming", reply, 2000))
+  {
+    std::cerr << "device did not enter stream mode" << std::endl;
+    return 1;
+  }
+  if (leds == 0) leds = atoi(reply.c_str() + strlen("streaming"));
+  if (leds <= 0)
+  {
+    std::cerr << "device has no LEDs configured" << std::endl;
+    return 1;
+  }
+  // Writes block from here on so USB backpressure paces us
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+  StreamEncoder encoder;
+  std::vector<uint8_t> packets;
+
+  if (uploadPath)
+  {
+    FILE* file = fopen(uploadPath, "rb");
+    if (!file)
+    {
+      perror(uploadPath);
+      return 1;
+    }
+    std::vector<uint8_t> image;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) image.insert(image.end(), chunk, chunk + n);
+    fclose(file);
+
+    // Erasing and programming take a while, so allow a second per 16 KiB
+    encoder.encodeUpload(image, packets);
+    bool sent = writeAll(fd, packets.data(), packets.size());
+    bool answered = sent && waitForLine(fd, "upload", reply, 2000 + (int)(image.size() / 16));
+    bool ok = answered && reply.compare(0, 9, "upload ok") == 0;
+    std::cout << (answered ? reply : std::string("no answer to the upload")) << std::endl;
+    packets.clear();
+    encoder.encodeExit(packets);
+    writeAll(fd, packets.data(), packets.size());
+    waitForLine(fd, "stream ended", reply, 2000);
+    close(fd);
+    return ok ? 0 : 1;
+  }
+
+  FILE* raw = nullptr;
+  if (rawPath)
+  {
+    raw = strcmp(rawPath, "-") == 0 ? stdin : fopen(rawPath, "rb");
+    if (!raw)
+    {
+      perror(rawPath);
+      return 1;
+    }
+  }
+
+  std::signal(SIGINT, [](int) { stopRequested = 1; });
+
+  LEDBuffer frame(leds);
+  LEDBuffer previous;
+  std::vector<uint8_t> rawFrame(leds * 3);
+  auto period = std::chrono::duration<double>(1.0 / fps);
+  auto nextFrame = std::chrono::steady_clock::now();
+  size_t totalBytes = 0;
+  long frames = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  while (!stopRequested && (maxFrames < 0 || frames < maxFrames))
+  {
+    if (raw)
+    {
+      if (fread(rawFrame.data(), 1, rawFrame.size(), raw) != rawFrame.size()) break;
+      for (int i = 0; i < leds; ++i)
+      {
+        frame[i] = RGBColor{rawFrame[i * 3], rawFrame[i * 3 + 1], rawFrame[i * 3 + 2]};
+      }
+    }
+    else
+    {
+      uint32_t hue = (uint32_t)(frames * 1024) << 16;
+      fillHueRamp(frame, hue, (uint32_t)(0x100000000ull / frame.size()));
+    }
+
+    packets.clear();
+    encoder.encodeFrame(frame, previous.empty() ? nullptr : &previous, packets);
+    if (!writeAll(fd, packets.data(), packets.size())) break;
+    totalBytes += packets.size();
+    previous = frame;
+    ++frames;
+
+    nextFrame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+    std::this_thread::sleep_until(nextFrame);
+  }
+
+  packets.clear();
+  encoder.encodeExit(packets);
+  writeAll(fd, packets.data(), packets.size());
+  if (waitForLine(fd, "stream ended", reply, 2000))
+  {
+    std::cout << reply << std::endl;
+  }
+
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "sent " << frames << " frames in " << sec << " s (" << frames / sec << " fps), "
+            << totalBytes / std::max(frames, 1L) << " bytes/frame" << std::endl;
+  close(fd);
+  return 0;
+}
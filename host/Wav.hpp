@@ -0,0 +1,110 @@
+#pragma once
+
+// Just enough WAV for the audio analysis tools: PCM 16-bit or float 32-bit,
+// any number of channels, read as mono 16-bit samples.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct WavAudio
+{
+  uint32_t sampleRate = 0;
+  std::vector<int16_t> samples;
+};
+
+// Parse a WAV file's bytes, mixing the channels down. Returns false for
+// anything that isn't 16-bit PCM or 32-bit float.
+inline bool parseWav(const std::vector<uint8_t>& bytes, WavAudio& audio)
+{
+  auto u16 = [&](size_t at) { return (uint32_t)bytes[at] | (uint32_t)bytes[at + 1] << 8; };
+  auto u32 = [&](size_t at) { return u16(at) | u16(at + 2) << 16; };
+  if (bytes.size() < 12 || memcmp(bytes.data(), "RIFF", 4) != 0 || memcmp(bytes.data() + 8, "WAVE", 4) != 0)
+  {
+    return false;
+  }
+  uint32_t format = 0, channels = 0, bits = 0;
+  for (size_t at = 12; at + 8 <= bytes.size();)
+  {
+    uint32_t size = u32(at + 4);
+    size_t body = at + 8;
+    size_t end = std::min(bytes.size(), body + size);
+    if (memcmp(&bytes[at], "fmt ", 4) == 0 && size >= 16)
+    {
+      format = u16(body);
+      channels = u16(body + 2);
+      audio.sampleRate = u32(body + 4);
+      bits = u16(body + 14);
+      // WAVE_FORMAT_EXTENSIBLE keeps the real format in its subformat GUID
+      if (format == 0xFFFE && size >= 26) format = u16(body + 24);
+    }
+    else if (memcmp(&bytes[at], "data", 4) == 0 && channels > 0)
+    {
+      bool pcm16 = format == 1 && bits == 16;
+      bool float32 = format == 3 && bits == 32;
+      if (!pcm16 && !float32) return false;
+      size_t frameBytes = channels * bits / 8;
+      audio.samples.clear();
+      for (size_t f = body; f + frameBytes <= end; f += frameBytes)
+      {
+        float sum = 0.0f;
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+          size_t s = f + c * bits / 8;
+          if (pcm16)
+          {
+            sum += (float)(int16_t)u16(s);
+          }
+          else
+          {
+            uint32_t word = u32(s);
+            float value;
+            memcpy(&value, &word, sizeof(value));
+            sum += value * 32767.0f;
+          }
+        }
+        audio.samples.push_back((int16_t)std::max(-32768.0f, std::min(32767.0f, sum / channels)));
+      }
+      return audio.sampleRate > 0;
+    }
+    at = body + size + (size & 1);
+  }
+  return false;
+}
+
+// A mono 16-bit PCM WAV file
+inline std::vector<uint8_t> makeWav(const std::vector<int16_t>& samples, uint32_t sampleRate)
+{
+  std::vector<uint8_t> bytes;
+  auto put16 = [&](uint32_t v) { bytes.push_back((uint8_t)v); bytes.push_back((uint8_t)(v >> 8)); };
+  auto put32 = [&](uint32_t v) { put16(v & 0xFFFF); put16(v >> 16); };
+  auto tag = [&](const char* t) { bytes.insert(bytes.end(), t, t + 4); };
+  uint32_t dataBytes = (uint32_t)samples.size() * 2;
+  tag("RIFF"); put32(36 + dataBytes); tag("WAVE");
+  tag("fmt "); put32(16); put16(1); put16(1); put32(sampleRate); put32(sampleRate * 2); put16(2); put16(16);
+  tag("data"); put32(dataBytes);
+  for (int16_t s : samples) put16((uint16_t)s);
+  return bytes;
+}
+
+// Bring the audio down to about rate by averaging whole groups of samples,
+// so it reaches the analyzer much as the ADC would sample it. Returns the
+// rate it ends up at.
+inline uint32_t decimateWav(WavAudio& audio, uint32_t rate)
+{
+  uint32_t factor = std::max<uint32_t>(1, (uint32_t)std::lround((double)audio.sampleRate / rate));
+  if (factor == 1) return audio.sampleRate;
+  std::vector<int16_t> out;
+  out.reserve(audio.samples.size() / factor);
+  for (size_t i = 0; i + factor <= audio.samples.size(); i += factor)
+  {
+    int32_t sum = 0;
+    for (uint32_t j = 0; j < factor; ++j) sum += audio.samples[i + j];
+    out.push_back((int16_t)(sum / (int32_t)factor));
+  }
+  audio.samples.swap(out);
+  audio.sampleRate /= factor;
+  return audio.sampleRate;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand-in for pi-pico-cpp's LedStripWs2812b. Only the buffer type is
+// needed on the host; output goes through LedOutput and MockWs2812bChain.
+
+#include <cpp/Color.hpp>
+
+#include <vector>
+
+using LEDBuffer = std::vector<RGBColor>;
@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stub for pico stdio: output goes to the process's stdout
+
+#include <cstdio>
+
+inline int stdio_put_string(const char* s, int len, bool /* newline */, bool /* cr_translation */)
+{
+  return (int)fwrite(s, 1, (size_t)len, stdout);
+}
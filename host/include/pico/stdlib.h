@@ -0,0 +1,21 @@
+#pragma once
+
+// Host stub for the pico stdlib: the integer types and no-op helpers the
+// shared sources rely on
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+typedef unsigned int uint;
+
+// Busy-wait loops yield on the host, where the "second core" is a thread that
+// may share a CPU with the main loop
+inline void tight_loop_contents() { std::this_thread::yield(); }
+
+// Free-running microsecond timer, wrapping like the pico's
+inline uint32_t time_us_32()
+{
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+// Host stub: nothing from this header is used outside the firmware build